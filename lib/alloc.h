@@ -0,0 +1,220 @@
+/*
+ * This file is part of libtw07, a header-only library for teeworlds0.7.
+ *
+ * Orignal Code by:
+ * Copyright (C) 2007-2025 Magnus Auvinen
+ *
+ * Libtw07 Library:
+ * Copyright (C) 2025 TeeworldsArchive
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty. In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ *
+ * Note: This is an altered version — a C language port of the original C++ implementation.
+ */
+#ifndef LIBTW07_ALLOC_H
+#define LIBTW07_ALLOC_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "thread.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* allocator hooks, a zeroed allocator uses malloc and free */
+
+struct libtw07_allocator
+{
+	void *(*m_pfnAlloc)(void *pUser, size_t Size);
+	void (*m_pfnFree)(void *pUser, void *pPtr);
+	void *m_pUser;
+};
+typedef struct libtw07_allocator libtw07_allocator;
+
+void *libtw07_allocator_alloc(const libtw07_allocator *pAllocator, size_t Size)
+{
+	if(!pAllocator || !pAllocator->m_pfnAlloc)
+		return malloc(Size);
+	return pAllocator->m_pfnAlloc(pAllocator->m_pUser, Size);
+}
+
+void libtw07_allocator_free(const libtw07_allocator *pAllocator, void *pPtr)
+{
+	if(!pPtr)
+		return;
+	if(!pAllocator || !pAllocator->m_pfnFree)
+		free(pPtr);
+	else
+		pAllocator->m_pfnFree(pAllocator->m_pUser, pPtr);
+}
+
+/* bump arena, memory is taken from large chunks and released all at once.
+   every allocation starts at an address aligned to LIBTW07_ARENA_ALIGNMENT */
+
+enum
+{
+	LIBTW07_ARENA_ALIGNMENT=16,
+	LIBTW07_ARENA_DEFAULT_CHUNK_SIZE=1024*1024,
+};
+
+struct libtw07_arenaChunk
+{
+	struct libtw07_arenaChunk *m_pNext;
+	size_t m_Size;
+	size_t m_Used;
+};
+typedef struct libtw07_arenaChunk libtw07_arenaChunk;
+
+// sits right in front of every allocation so the most recent ones can be given back, the
+// allocation itself is aligned by its address so the header size does not matter
+struct libtw07_arenaBlock
+{
+	size_t m_Start;
+	size_t m_End;
+};
+typedef struct libtw07_arenaBlock libtw07_arenaBlock;
+
+struct libtw07_arena
+{
+	libtw07_allocator m_Backing;
+	libtw07_lock m_Lock;
+	size_t m_ChunkSize;
+	libtw07_arenaChunk *m_pChunks; // the newest chunk is first
+	size_t m_NumChunks;
+	size_t m_NumBytes;
+};
+typedef struct libtw07_arena libtw07_arena;
+
+// chunks come from pBacking, or from malloc when it is 0
+void libtw07_arena_init(libtw07_arena *pArena, const libtw07_allocator *pBacking, size_t ChunkSize)
+{
+	if(pBacking)
+		pArena->m_Backing = *pBacking;
+	else
+	{
+		pArena->m_Backing.m_pfnAlloc = 0;
+		pArena->m_Backing.m_pfnFree = 0;
+		pArena->m_Backing.m_pUser = 0;
+	}
+	libtw07_lock_init(&pArena->m_Lock);
+	pArena->m_ChunkSize = ChunkSize ? ChunkSize : (size_t)LIBTW07_ARENA_DEFAULT_CHUNK_SIZE;
+	pArena->m_pChunks = 0;
+	pArena->m_NumChunks = 0;
+	pArena->m_NumBytes = 0;
+}
+
+size_t _libtw07_arena_align(size_t Size)
+{
+	return (Size + LIBTW07_ARENA_ALIGNMENT - 1) & ~(size_t)(LIBTW07_ARENA_ALIGNMENT - 1);
+}
+
+void *libtw07_arena_alloc(libtw07_arena *pArena, size_t Size)
+{
+	// the header plus the worst case padding in front of the aligned memory
+	size_t Needed = sizeof(libtw07_arenaBlock) + LIBTW07_ARENA_ALIGNMENT - 1 + _libtw07_arena_align(Size);
+
+	libtw07_lock_wait(&pArena->m_Lock);
+	libtw07_arenaChunk *pChunk = pArena->m_pChunks;
+	if(!pChunk || pChunk->m_Size - pChunk->m_Used < Needed)
+	{
+		// allocations larger than a chunk get a chunk of their own
+		size_t ChunkSize = Needed > pArena->m_ChunkSize ? Needed : pArena->m_ChunkSize;
+		pChunk = (libtw07_arenaChunk *) libtw07_allocator_alloc(&pArena->m_Backing, sizeof(libtw07_arenaChunk) + ChunkSize);
+		if(!pChunk)
+		{
+			libtw07_lock_unlock(&pArena->m_Lock);
+			return 0;
+		}
+		pChunk->m_Size = ChunkSize;
+		pChunk->m_Used = 0;
+		pChunk->m_pNext = pArena->m_pChunks;
+		pArena->m_pChunks = pChunk;
+		pArena->m_NumChunks++;
+		pArena->m_NumBytes += ChunkSize;
+	}
+
+	unsigned char *pBase = (unsigned char *)(pChunk+1);
+	uintptr_t Memory = (uintptr_t)(pBase + pChunk->m_Used + sizeof(libtw07_arenaBlock));
+	Memory = (Memory + LIBTW07_ARENA_ALIGNMENT - 1) & ~(uintptr_t)(LIBTW07_ARENA_ALIGNMENT - 1);
+	libtw07_arenaBlock *pBlock = (libtw07_arenaBlock *)Memory - 1;
+	pBlock->m_Start = pChunk->m_Used;
+	pBlock->m_End = (size_t)(Memory - (uintptr_t)pBase) + _libtw07_arena_align(Size);
+	pChunk->m_Used = pBlock->m_End;
+	libtw07_lock_unlock(&pArena->m_Lock);
+	return (void *)Memory;
+}
+
+// only gives the memory back when it is the most recent allocation of the newest chunk,
+// everything else stays until the arena is destroyed
+void libtw07_arena_free(libtw07_arena *pArena, void *pPtr)
+{
+	if(!pPtr)
+		return;
+
+	libtw07_lock_wait(&pArena->m_Lock);
+	libtw07_arenaChunk *pChunk = pArena->m_pChunks;
+	if(pChunk)
+	{
+		unsigned char *pBase = (unsigned char *)(pChunk+1);
+		libtw07_arenaBlock *pBlock = (libtw07_arenaBlock *)pPtr - 1;
+		if((unsigned char *)pBlock >= pBase && (unsigned char *)pBlock < pBase + pChunk->m_Used && pBlock->m_End == pChunk->m_Used)
+			pChunk->m_Used = pBlock->m_Start;
+	}
+	libtw07_lock_unlock(&pArena->m_Lock);
+}
+
+void libtw07_arena_destroy(libtw07_arena *pArena)
+{
+	libtw07_arenaChunk *pChunk = pArena->m_pChunks;
+	while(pChunk)
+	{
+		libtw07_arenaChunk *pNext = pChunk->m_pNext;
+		libtw07_allocator_free(&pArena->m_Backing, pChunk);
+		pChunk = pNext;
+	}
+	pArena->m_pChunks = 0;
+	pArena->m_NumChunks = 0;
+	pArena->m_NumBytes = 0;
+	libtw07_lock_destroy(&pArena->m_Lock);
+}
+
+void *_libtw07_arena_allocHook(void *pUser, size_t Size)
+{
+	return libtw07_arena_alloc((libtw07_arena *)pUser, Size);
+}
+
+void _libtw07_arena_freeHook(void *pUser, void *pPtr)
+{
+	libtw07_arena_free((libtw07_arena *)pUser, pPtr);
+}
+
+// fills in hooks that allocate from the arena
+void libtw07_arena_allocator(libtw07_arena *pArena, libtw07_allocator *pAllocator)
+{
+	pAllocator->m_pfnAlloc = _libtw07_arena_allocHook;
+	pAllocator->m_pfnFree = _libtw07_arena_freeHook;
+	pAllocator->m_pUser = pArena;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // LIBTW07_ALLOC_H
@@ -0,0 +1,202 @@
+/*
+ * This file is part of libtw07, a header-only library for teeworlds0.7.
+ *
+ * Orignal Code by:
+ * Copyright (C) 2007-2025 Magnus Auvinen
+ *
+ * Libtw07 Library:
+ * Copyright (C) 2025 TeeworldsArchive
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty. In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ *
+ * Note: This is an altered version — a C language port of the original C++ implementation.
+ */
+#ifndef LIBTW07_COLLISION_H
+#define LIBTW07_COLLISION_H
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "map.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// collision of the game layer with 2 bits per tile, each tile holds LIBTW07_TILE_AIR, _SOLID,
+// _DEATH or _NOHOOK. the map is surrounded by m_Border tiles that repeat its edges, so tiles up
+// to m_Border outside the map give the same answer as clamping without any checks
+struct libtw07_collision
+{
+	int m_Width;
+	int m_Height;
+	int m_Border;
+	int m_Stride; // bytes per row, 4 tiles per byte
+	unsigned char *m_pGrid;
+	unsigned char *m_pOrigin; // row of tile y = 0, tile x = 0 is m_Border tiles into it
+	libtw07_allocator m_Allocator; // m_pGrid comes from it
+};
+typedef struct libtw07_collision libtw07_collision;
+
+enum
+{
+	LIBTW07_COLLISION_DEFAULT_BORDER = 8,
+};
+
+// the collision value of a game layer tile, entities count as air
+static inline int _libtw07_collision_fromTile(const libtw07_map_tile *pTile)
+{
+	switch(pTile->m_Index)
+	{
+	case LIBTW07_TILE_SOLID: return LIBTW07_TILE_SOLID;
+	case LIBTW07_TILE_DEATH: return LIBTW07_TILE_DEATH;
+	case LIBTW07_TILE_NOHOOK: return LIBTW07_TILE_NOHOOK;
+	}
+	return LIBTW07_TILE_AIR;
+}
+
+// builds the grid with memory from pAllocator, or from malloc when it is 0
+int _libtw07_collision_build(libtw07_collision *pCol, const libtw07_map_tile *pTiles, int Width, int Height, int Border, const libtw07_allocator *pAllocator)
+{
+	memset(pCol, 0, sizeof(*pCol));
+	if(Width <= 0 || Height <= 0 || Border < 0 || Width > 0x10000 || Height > 0x10000 || Border > 0x10000)
+		return -1;
+
+	int PaddedWidth = Width + 2 * Border;
+	int PaddedHeight = Height + 2 * Border;
+	int Stride = (PaddedWidth + 3) / 4;
+	if((int64_t)Stride * PaddedHeight > 0x7fffffff)
+		return -1;
+
+	unsigned char *pGrid = (unsigned char *) libtw07_allocator_alloc(pAllocator, (size_t)Stride * PaddedHeight);
+	if(!pGrid)
+		return -1;
+	memset(pGrid, 0, (size_t)Stride * PaddedHeight);
+
+	for(int py = 0; py < PaddedHeight; py++)
+	{
+		int y = libtw07_clamp(py - Border, 0, Height - 1);
+		unsigned char *pRow = pGrid + (size_t)py * Stride;
+		for(int px = 0; px < PaddedWidth; px++)
+		{
+			int x = libtw07_clamp(px - Border, 0, Width - 1);
+			pRow[px >> 2] |= _libtw07_collision_fromTile(&pTiles[y * Width + x]) << ((px & 3) * 2);
+		}
+	}
+
+	pCol->m_Width = Width;
+	pCol->m_Height = Height;
+	pCol->m_Border = Border;
+	pCol->m_Stride = Stride;
+	pCol->m_pGrid = pGrid;
+	pCol->m_pOrigin = pGrid + (size_t)Border * Stride;
+	if(pAllocator)
+		pCol->m_Allocator = *pAllocator;
+	return 0;
+}
+
+// builds the grid from Width * Height game layer tiles, returns -1 on failure
+int libtw07_collision_initFromTiles(libtw07_collision *pCol, const libtw07_map_tile *pTiles, int Width, int Height, int Border)
+{
+	return _libtw07_collision_build(pCol, pTiles, Width, Height, Border, 0);
+}
+
+// builds the grid from the layer flagged LIBTW07_TILESLAYERFLAG_GAME, returns -1 when there is none.
+// the grid comes from the map's allocator, with an arena it has to be destroyed before the map is closed
+int libtw07_collision_init(libtw07_collision *pCol, libtw07_map_reader *pMap, int Border)
+{
+	memset(pCol, 0, sizeof(*pCol));
+
+	int LayersStart, LayersNum;
+	libtw07_datafile_reader_getType(pMap, LIBTW07_MAPITEMTYPE_LAYER, &LayersStart, &LayersNum);
+	for(int l = 0; l < LayersNum; l++)
+	{
+		libtw07_map_itemLayerTilemap *pTilemap = libtw07_map_reader_getTilemap(pMap, l);
+		if(!pTilemap || !(pTilemap->m_Flags&LIBTW07_TILESLAYERFLAG_GAME))
+			continue;
+
+		libtw07_map_tile *pTiles = libtw07_map_reader_getTiles(pMap, l);
+		if(!pTiles)
+			return -1;
+		return _libtw07_collision_build(pCol, pTiles, pTilemap->m_Width, pTilemap->m_Height, Border, &pMap->m_pDataFile->m_Allocator);
+	}
+
+	libtw07_print("collision", "the map has no game layer");
+	return -1;
+}
+
+void libtw07_collision_destroy(libtw07_collision *pCol)
+{
+	libtw07_allocator_free(&pCol->m_Allocator, pCol->m_pGrid);
+	memset(pCol, 0, sizeof(*pCol));
+}
+
+// unchecked, tile x, y has to be at most m_Border tiles outside the map or the read is out of
+// bounds. libtw07_collision_getTileClamped takes any tile
+static inline int libtw07_collision_getTile(const libtw07_collision *pCol, int x, int y)
+{
+	int px = x + pCol->m_Border;
+	return (pCol->m_pOrigin[y * pCol->m_Stride + (px >> 2)] >> ((px & 3) * 2)) & 3;
+}
+
+// any tile, the ones outside are those of the nearest edge
+static inline int libtw07_collision_getTileClamped(const libtw07_collision *pCol, int x, int y)
+{
+	x = libtw07_clamp(x, -pCol->m_Border, pCol->m_Width - 1 + pCol->m_Border);
+	y = libtw07_clamp(y, -pCol->m_Border, pCol->m_Height - 1 + pCol->m_Border);
+	return libtw07_collision_getTile(pCol, x, y);
+}
+
+// keeps a world coordinate within the grid and its border before it becomes an int, so
+// positions far off the map, infinities and NaN give the tile at the nearest edge
+static inline float _libtw07_collision_clampWorld(float v, int Size, int Border)
+{
+	float Min = -Border * 32.0f;
+	float Max = (Size + Border) * 32.0f - 1.0f;
+	if(!(v >= Min))
+		return Min;
+	return v > Max ? Max : v;
+}
+
+// position in world units, 32 per tile. any position works, the ones outside the grid give the
+// tile at the nearest edge like libtw07_collision_getTileClamped
+static inline int libtw07_collision_getAt(const libtw07_collision *pCol, float x, float y)
+{
+	x = _libtw07_collision_clampWorld(x, pCol->m_Width, pCol->m_Border);
+	y = _libtw07_collision_clampWorld(y, pCol->m_Height, pCol->m_Border);
+	int ix = (int)(x < 0.0f ? x - 0.5f : x + 0.5f);
+	int iy = (int)(y < 0.0f ? y - 0.5f : y + 0.5f);
+	return libtw07_collision_getTileClamped(pCol, ix >> 5, iy >> 5);
+}
+
+// solid and nohook tiles both block movement
+static inline int libtw07_collision_isSolid(int Tile)
+{
+	return Tile == LIBTW07_TILE_SOLID || Tile == LIBTW07_TILE_NOHOOK;
+}
+
+// whether a world position is blocked, positions off the map are safe and see the nearest edge
+static inline int libtw07_collision_checkPoint(const libtw07_collision *pCol, float x, float y)
+{
+	return libtw07_collision_isSolid(libtw07_collision_getAt(pCol, x, y));
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // LIBTW07_COLLISION_H
@@ -28,17 +28,36 @@
 #ifndef LIBTW07_DATAFILE_H
 #define LIBTW07_DATAFILE_H
 
+#include <limits.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 
 #include "external/miniz/miniz.h"
 
+#include "alloc.h"
 #include "detect.h"
 #include "hash.h"
+#include "jobs.h"
 #include "math.h"
 #include "print.h"
 
+#if defined(CONF_FAMILY_UNIX)
+	#include <errno.h>
+	#include <fcntl.h>
+	#include <sys/mman.h>
+	#include <sys/stat.h>
+	#include <unistd.h>
+#elif defined(CONF_FAMILY_WINDOWS)
+	#include <io.h>
+#endif
+
+// mmap, pread, fileno and posix_madvise are hidden by strict modes like -std=c99
+// unless a feature macro asks for them, without them the file is read with stdio
+#if defined(CONF_FAMILY_UNIX) && (!defined(__STRICT_ANSI__) || defined(_GNU_SOURCE) || defined(_DEFAULT_SOURCE) || defined(_BSD_SOURCE) \
+	|| (defined(_POSIX_C_SOURCE) && _POSIX_C_SOURCE >= 200809L) || (defined(_XOPEN_SOURCE) && _XOPEN_SOURCE >= 600))
+	#define LIBTW07_DATAFILE_POSIX 1
+#endif
 
 #ifdef __cplusplus
 extern "C" {
@@ -98,9 +117,54 @@ struct libtw07_datafileInfo
 };
 typedef struct libtw07_datafileInfo libtw07_datafileInfo;
 
+struct libtw07_datafileIndexEntry
+{
+	uint32_t m_Key; // type << 16 | id
+	int m_Item; // item (or item type) index + 1, 0 for an empty slot
+};
+typedef struct libtw07_datafileIndexEntry libtw07_datafileIndexEntry;
+
+enum
+{
+	// types below this are looked up in a dense table, the rest (uuid items and such) through a hash
+	LIBTW07_DATAFILE_INDEX_DENSE_TYPES=256,
+};
+
+struct libtw07_datafileCacheStats
+{
+	int64_t m_Budget;
+	int64_t m_ResidentBytes;
+	int64_t m_Hits;
+	int64_t m_Misses;
+	int64_t m_Evictions;
+};
+typedef struct libtw07_datafileCacheStats libtw07_datafileCacheStats;
+
+// keeps the loaded blocks within a byte budget, unpinned blocks are evicted least recently used first
+struct libtw07_datafileCache
+{
+	libtw07_lock m_Lock;
+	libtw07_datafileCacheStats m_Stats;
+	int *m_pRefs;
+	int *m_pPrev;
+	int *m_pNext;
+	int m_First; // least recently used
+	int m_Last;
+};
+typedef struct libtw07_datafileCache libtw07_datafileCache;
+
 struct libtw07_datafile
 {
 	FILE *m_File;
+	unsigned char *m_pMapped;
+	int64_t m_MappedSize;
+	int m_Mapping; // how m_pMapped is released
+	int m_Flags;
+	volatile int m_Hashed;
+	libtw07_lock m_HashLock;
+	libtw07_lock m_ReadLock; // only used without positional reads
+	libtw07_lock m_LoadLock;
+	libtw07_cond m_LoadCond; // signaled when a block leaves the loading state
 	SHA256_DIGEST m_Sha256;
 	uint32_t m_Crc;
 	libtw07_datafileInfo m_Info;
@@ -108,22 +172,107 @@ struct libtw07_datafile
 	int m_DataStartOffset;
 	char **m_ppDataPtrs;
 	int *m_pDataSizes;
+	volatile int *m_pDataStates;
+	unsigned char *m_pDataFlags;
 	char *m_pData;
+
+	// lookup index, built while opening
+	int m_NumTypeIndices;
+	int *m_pTypeIndices; // type -> index into m_Info.m_pItemTypes or -1
+	uint32_t m_TypeHashMask;
+	libtw07_datafileIndexEntry *m_pTypeHash; // types above the dense table
+	uint32_t m_ItemHashMask;
+	libtw07_datafileIndexEntry *m_pItemHash; // (type, id) -> item index
+	void *m_pIndex;
+
+	libtw07_datafileCache *m_pCache;
+
+	// everything the reader allocates comes from here, including this block
+	libtw07_allocator m_Allocator;
+	libtw07_arena *m_pArena;
 };
 typedef struct libtw07_datafile libtw07_datafile;
 
+enum
+{
+	// map the whole file instead of reading it, item section and uncompressed data are used in place
+	LIBTW07_DATAFILE_OPENFLAG_MMAP=1,
+	// take sha256 and crc on the first call to libtw07_datafile_reader_sha256 or _crc instead of while opening
+	LIBTW07_DATAFILE_OPENFLAG_HASH_LAZY=2,
+	// never hash the file, sha256 and crc report the values of a closed reader
+	LIBTW07_DATAFILE_OPENFLAG_HASH_NONE=4,
+
+	// ownership of the buffer passed to libtw07_datafile_reader_openMemory
+	LIBTW07_DATAFILE_MEMORY_BORROW=0, // stays with the caller and has to outlive the reader
+	LIBTW07_DATAFILE_MEMORY_TAKE, // freed with free() when the reader is closed, a failed open leaves it to the caller
+
+	LIBTW07_DATAFILE_MAPPING_NONE=0,
+	LIBTW07_DATAFILE_MAPPING_MMAP,
+	LIBTW07_DATAFILE_MAPPING_BORROWED,
+	LIBTW07_DATAFILE_MAPPING_OWNED,
+
+	// the data pointer points into the mapped file and must not be freed
+	LIBTW07_DATAFILE_DATAFLAG_BORROWED=1,
+	// handed out by getData or replaceData without a pin, the cache never evicts it
+	LIBTW07_DATAFILE_DATAFLAG_STICKY=2,
+	// set by replaceData, cleared when the block is unloaded
+	LIBTW07_DATAFILE_DATAFLAG_REPLACED=4,
+
+	// blocks are loaded once, threads that want a block which is being loaded wait for it. without a
+	// cache a loaded block is handed out without taking any lock, with a cache every getData and
+	// pinData goes through the cache lock
+	LIBTW07_DATAFILE_DATASTATE_UNLOADED=0,
+	LIBTW07_DATAFILE_DATASTATE_LOADING,
+	LIBTW07_DATAFILE_DATASTATE_LOADED,
+};
+
 struct libtw07_datafileReader
 {
 	libtw07_datafile *m_pDataFile;
+
+	// used by the next open
+	libtw07_allocator m_Allocator;
+	size_t m_ArenaChunkSize;
 };
 typedef struct libtw07_datafileReader libtw07_datafileReader;
 
 int libtw07_datafile_reader_open(libtw07_datafileReader *pReader, const char *pFilename);
+int libtw07_datafile_reader_openEx(libtw07_datafileReader *pReader, const char *pFilename, int Flags);
+// the buffer is parsed in place. with LIBTW07_DATAFILE_MEMORY_TAKE the reader frees it once the open
+// succeeded, when the open fails the buffer stays with the caller for either ownership
+int libtw07_datafile_reader_openMemory(libtw07_datafileReader *pReader, void *pData, int64_t Size, int Ownership);
+int libtw07_datafile_reader_openMemoryEx(libtw07_datafileReader *pReader, void *pData, int64_t Size, int Ownership, int Flags);
 int libtw07_datafile_reader_close(libtw07_datafileReader *pReader);
 
 void libtw07_datafile_reader_init(libtw07_datafileReader *pReader)
 {
 	pReader->m_pDataFile = NULL;
+	pReader->m_Allocator.m_pfnAlloc = 0;
+	pReader->m_Allocator.m_pfnFree = 0;
+	pReader->m_Allocator.m_pUser = 0;
+	pReader->m_ArenaChunkSize = 0;
+}
+
+// sets the allocator used from the next open on, 0 goes back to malloc and free. loadData and the
+// map reader's loadTiles call it from the threads of their job pool, so the hooks have to be thread-safe
+void libtw07_datafile_reader_setAllocator(libtw07_datafileReader *pReader, const libtw07_allocator *pAllocator)
+{
+	if(pAllocator)
+		pReader->m_Allocator = *pAllocator;
+	else
+	{
+		pReader->m_Allocator.m_pfnAlloc = 0;
+		pReader->m_Allocator.m_pfnFree = 0;
+		pReader->m_Allocator.m_pUser = 0;
+	}
+}
+
+// from the next open on all memory of the datafile comes from an arena with chunks of ChunkSize
+// bytes, taken from the allocator. it is released at once on close, 0 turns the arena off.
+// an arena never gives memory back before that, so setCacheBudget fails on such a reader
+void libtw07_datafile_reader_setArena(libtw07_datafileReader *pReader, size_t ChunkSize)
+{
+	pReader->m_ArenaChunkSize = ChunkSize;
 }
 
 void libtw07_datafile_reader_destroy(libtw07_datafileReader *pReader)
@@ -138,338 +287,1573 @@ int libtw07_datafile_reader_isOpen(libtw07_datafileReader *pReader)
 	return -1;
 }
 
-int libtw07_datafile_reader_open(libtw07_datafileReader *pReader, const char *pFilename)
+int _libtw07_datafile_reader_checkHeader(libtw07_datafileHeader *pHeader, int64_t *pSize)
 {
-	libtw07_print("datafile", "loading. filename='%s'", pFilename);
-
-	FILE *File = fopen(pFilename, "rb");
-	if(!File)
-	{
-		libtw07_print("datafile", "could not open '%s'", pFilename);
-		return -1;
-	}
-
-
-	// take the hashes of the file and store them
-	SHA256_CTX Sha256Ctx;
-	sha256_init(&Sha256Ctx);
-	uint32_t Crc = crc32(0L, 0x0, 0);
-	{
-		enum
-		{
-			BUFFER_SIZE = 64*1024
-		};
-
-		unsigned char aBuffer[BUFFER_SIZE];
-
-		while(1)
-		{
-			unsigned Bytes = fread(aBuffer, 1, BUFFER_SIZE, File);
-			if(Bytes == 0)
-				break;
-			sha256_update(&Sha256Ctx, aBuffer, Bytes);
-			Crc = crc32(Crc, aBuffer, Bytes);
-		}
-
-		fseek(File, 0, SEEK_SET);
-	}
-
-	libtw07_datafileHeader Header;
-	fread(&Header, 1, sizeof(Header), File);
-	if(Header.m_aID[0] != 'A' || Header.m_aID[1] != 'T' || Header.m_aID[2] != 'A' || Header.m_aID[3] != 'D')
+	if(pHeader->m_aID[0] != 'A' || pHeader->m_aID[1] != 'T' || pHeader->m_aID[2] != 'A' || pHeader->m_aID[3] != 'D')
 	{
-		if(Header.m_aID[0] != 'D' || Header.m_aID[1] != 'A' || Header.m_aID[2] != 'T' || Header.m_aID[3] != 'A')
+		if(pHeader->m_aID[0] != 'D' || pHeader->m_aID[1] != 'A' || pHeader->m_aID[2] != 'T' || pHeader->m_aID[3] != 'A')
 		{
-			libtw07_print("datafile", "wrong signature. %x %x %x %x", Header.m_aID[0], Header.m_aID[1], Header.m_aID[2], Header.m_aID[3]);
-			fclose(File);
-			return 0;
+			libtw07_print("datafile", "wrong signature. %x %x %x %x", pHeader->m_aID[0], pHeader->m_aID[1], pHeader->m_aID[2], pHeader->m_aID[3]);
+			return -1;
 		}
 	}
 
 #if defined(CONF_ARCH_ENDIAN_BIG)
-	swap_endian(&Header, sizeof(int), sizeof(Header)/sizeof(int));
+	swap_endian(pHeader, sizeof(int), sizeof(*pHeader)/sizeof(int));
 #endif
-	if(Header.m_Version != 3 && Header.m_Version != 4)
+	if(pHeader->m_Version != 3 && pHeader->m_Version != 4)
 	{
-		libtw07_print("datafile", "wrong version. version=%x", Header.m_Version);
-		fclose(File);
-		return 0;
+		libtw07_print("datafile", "wrong version. version=%x", pHeader->m_Version);
+		return -1;
 	}
 
-	// read in the rest except the data
+	// size of everything except the data
 	int64_t Size = 0;
-	Size += Header.m_NumItemTypes*sizeof(libtw07_datafileItemType);
-	Size += (Header.m_NumItems+Header.m_NumRawData)*sizeof(int);
-	if(Header.m_Version == 4)
-		Size += Header.m_NumRawData*sizeof(int); // v4 has uncompressed data sizes aswell
-	Size += Header.m_ItemSize;
+	Size += pHeader->m_NumItemTypes*sizeof(libtw07_datafileItemType);
+	Size += (pHeader->m_NumItems+pHeader->m_NumRawData)*sizeof(int);
+	if(pHeader->m_Version == 4)
+		Size += pHeader->m_NumRawData*sizeof(int); // v4 has uncompressed data sizes aswell
+	Size += pHeader->m_ItemSize;
 
-	int64_t AllocSize = Size;
-	AllocSize += sizeof(libtw07_datafile); // add space for info structure
-	AllocSize += Header.m_NumRawData*sizeof(void*); // add space for data pointers
-	AllocSize += Header.m_NumRawData*sizeof(int); // add space for data sizes
-	if(Size > (1LL << 31LL) || Header.m_NumItemTypes < 0 || Header.m_NumItems < 0 || Header.m_NumRawData < 0 || Header.m_ItemSize < 0)
+	if(Size > (1LL << 31LL) || pHeader->m_NumItemTypes < 0 || pHeader->m_NumItems < 0 || pHeader->m_NumRawData < 0 || pHeader->m_ItemSize < 0)
 	{
-		fclose(File);
 		libtw07_print("datafile", "unable to load file, invalid file information");
 		return -1;
 	}
 
-	libtw07_datafile *pTmpDataFile = (libtw07_datafile *) malloc(AllocSize);
-	pTmpDataFile->m_Header = Header;
-	pTmpDataFile->m_DataStartOffset = sizeof(libtw07_datafileHeader) + Size;
-	pTmpDataFile->m_ppDataPtrs = (char **)(pTmpDataFile+1);
-	pTmpDataFile->m_pDataSizes = (int *)(pTmpDataFile->m_ppDataPtrs + Header.m_NumRawData);
-	pTmpDataFile->m_pData = (char *)(pTmpDataFile->m_pDataSizes + Header.m_NumRawData);
-	pTmpDataFile->m_File = File;
-	pTmpDataFile->m_Sha256 = sha256_finish(&Sha256Ctx);
-	pTmpDataFile->m_Crc = Crc;
-
-	// clear the data pointers and sizes
-	memset(pTmpDataFile->m_ppDataPtrs, 0, Header.m_NumRawData*sizeof(void*));
-	memset(pTmpDataFile->m_pDataSizes, 0, Header.m_NumRawData*sizeof(int));
+	*pSize = Size;
+	return 0;
+}
 
-	// read types, offsets, sizes and item data
-	uint32_t ReadSize = fread(pTmpDataFile->m_pData, 1, Size, File);
-	if(ReadSize != Size)
+libtw07_datafile *_libtw07_datafile_reader_allocDataFile(libtw07_datafileReader *pReader, const libtw07_datafileHeader *pHeader, int64_t Size, int64_t *pAllocSize)
+{
+	int64_t AllocSize = Size;
+	AllocSize += sizeof(libtw07_datafile); // add space for info structure
+	AllocSize += pHeader->m_NumRawData*sizeof(void*); // add space for data pointers
+	AllocSize += pHeader->m_NumRawData*sizeof(int); // add space for data sizes
+	AllocSize += pHeader->m_NumRawData*sizeof(int); // add space for data states
+	AllocSize += (pHeader->m_NumRawData+7)&~7; // add space for data flags, keeps the rest aligned
+
+	libtw07_allocator Allocator = pReader->m_Allocator;
+	libtw07_arena *pArena = 0;
+	if(pReader->m_ArenaChunkSize)
 	{
-		fclose(pTmpDataFile->m_File);
-		free(pTmpDataFile);
-		pTmpDataFile = 0;
-		libtw07_print("datafile", "couldn't load the whole thing, wanted=%d got=%d", (uint32_t) Size, ReadSize);
-		return -1;
+		pArena = (libtw07_arena *) libtw07_allocator_alloc(&pReader->m_Allocator, sizeof(libtw07_arena));
+		if(!pArena)
+			return 0;
+		libtw07_arena_init(pArena, &pReader->m_Allocator, pReader->m_ArenaChunkSize);
+		libtw07_arena_allocator(pArena, &Allocator);
 	}
 
-	libtw07_datafile_reader_close(pReader);
-	pReader->m_pDataFile = pTmpDataFile;
+	libtw07_datafile *pDataFile = (libtw07_datafile *) libtw07_allocator_alloc(&Allocator, AllocSize);
+	if(!pDataFile)
+	{
+		if(pArena)
+		{
+			libtw07_arena_destroy(pArena);
+			libtw07_allocator_free(&pReader->m_Allocator, pArena);
+		}
+		return 0;
+	}
 
-#if defined(CONF_ARCH_ENDIAN_BIG)
-	swap_endian(pReader->m_pDataFile->m_pData, sizeof(int), libtw07_minimum((uint32_t) Header.m_Swaplen, (uint32_t) Size) / sizeof(int));
-#endif
+	pDataFile->m_File = 0;
+	pDataFile->m_pMapped = 0;
+	pDataFile->m_MappedSize = 0;
+	pDataFile->m_Mapping = LIBTW07_DATAFILE_MAPPING_NONE;
+	pDataFile->m_Flags = 0;
+	pDataFile->m_Hashed = 0;
+	pDataFile->m_NumTypeIndices = 0;
+	pDataFile->m_pTypeIndices = 0;
+	pDataFile->m_TypeHashMask = 0;
+	pDataFile->m_pTypeHash = 0;
+	pDataFile->m_ItemHashMask = 0;
+	pDataFile->m_pItemHash = 0;
+	pDataFile->m_pIndex = 0;
+	pDataFile->m_pCache = 0;
+	pDataFile->m_Allocator = Allocator;
+	pDataFile->m_pArena = pArena;
+	pDataFile->m_Header = *pHeader;
+	pDataFile->m_DataStartOffset = sizeof(libtw07_datafileHeader) + Size;
+	pDataFile->m_ppDataPtrs = (char **)(pDataFile+1);
+	pDataFile->m_pDataSizes = (int *)(pDataFile->m_ppDataPtrs + pHeader->m_NumRawData);
+	pDataFile->m_pDataStates = (volatile int *)(pDataFile->m_pDataSizes + pHeader->m_NumRawData);
+	pDataFile->m_pDataFlags = (unsigned char *)(pDataFile->m_pDataStates + pHeader->m_NumRawData);
+	pDataFile->m_pData = (char *)(pDataFile->m_pDataFlags + ((pHeader->m_NumRawData+7)&~7));
+
+	// clear the data pointers, sizes, states and flags
+	memset(pDataFile->m_ppDataPtrs, 0, pHeader->m_NumRawData*sizeof(void*));
+	memset(pDataFile->m_pDataSizes, 0, pHeader->m_NumRawData*sizeof(int));
+	memset((void *)pDataFile->m_pDataStates, 0, pHeader->m_NumRawData*sizeof(int));
+	memset(pDataFile->m_pDataFlags, 0, pHeader->m_NumRawData);
+	libtw07_lock_init(&pDataFile->m_HashLock);
+	libtw07_lock_init(&pDataFile->m_ReadLock);
+	libtw07_lock_init(&pDataFile->m_LoadLock);
+	libtw07_cond_init(&pDataFile->m_LoadCond);
+
+	if(pAllocSize)
+		*pAllocSize = AllocSize;
+	return pDataFile;
+}
 
-	//if(LIBTW07_DATAFILE_DEBUG)
+// releases the block from allocDataFile, together with the arena when there is one
+void _libtw07_datafile_reader_freeDataFile(libtw07_datafile *pDataFile)
+{
+	libtw07_arena *pArena = pDataFile->m_pArena;
+	libtw07_lock_destroy(&pDataFile->m_HashLock);
+	libtw07_lock_destroy(&pDataFile->m_ReadLock);
+	libtw07_cond_destroy(&pDataFile->m_LoadCond);
+	libtw07_lock_destroy(&pDataFile->m_LoadLock);
+	libtw07_allocator_free(&pDataFile->m_Allocator, pDataFile);
+	if(pArena)
 	{
-		libtw07_print("datafile", "allocsize=%d", (uint32_t) AllocSize);
-		libtw07_print("datafile", "readsize=%d", ReadSize);
-		libtw07_print("datafile", "swaplen=%d", Header.m_Swaplen);
-		libtw07_print("datafile", "item_size=%d", pReader->m_pDataFile->m_Header.m_ItemSize);
+		libtw07_allocator Backing = pArena->m_Backing;
+		libtw07_arena_destroy(pArena);
+		libtw07_allocator_free(&Backing, pArena);
 	}
+}
 
-	pReader->m_pDataFile->m_Info.m_pItemTypes = (libtw07_datafileItemType *)pReader->m_pDataFile->m_pData;
-	pReader->m_pDataFile->m_Info.m_pItemOffsets = (int *)&pReader->m_pDataFile->m_Info.m_pItemTypes[pReader->m_pDataFile->m_Header.m_NumItemTypes];
-	pReader->m_pDataFile->m_Info.m_pDataOffsets = (int *)&pReader->m_pDataFile->m_Info.m_pItemOffsets[pReader->m_pDataFile->m_Header.m_NumItems];
-	pReader->m_pDataFile->m_Info.m_pDataSizes = (int *)&pReader->m_pDataFile->m_Info.m_pDataOffsets[pReader->m_pDataFile->m_Header.m_NumRawData];
+void _libtw07_datafile_reader_setupInfo(libtw07_datafile *pDataFile)
+{
+	pDataFile->m_Info.m_pItemTypes = (libtw07_datafileItemType *)pDataFile->m_pData;
+	pDataFile->m_Info.m_pItemOffsets = (int *)&pDataFile->m_Info.m_pItemTypes[pDataFile->m_Header.m_NumItemTypes];
+	pDataFile->m_Info.m_pDataOffsets = (int *)&pDataFile->m_Info.m_pItemOffsets[pDataFile->m_Header.m_NumItems];
+	pDataFile->m_Info.m_pDataSizes = (int *)&pDataFile->m_Info.m_pDataOffsets[pDataFile->m_Header.m_NumRawData];
 
-	if(Header.m_Version == 4)
-		pReader->m_pDataFile->m_Info.m_pItemStart = (char *)&pReader->m_pDataFile->m_Info.m_pDataSizes[pReader->m_pDataFile->m_Header.m_NumRawData];
+	if(pDataFile->m_Header.m_Version == 4)
+		pDataFile->m_Info.m_pItemStart = (char *)&pDataFile->m_Info.m_pDataSizes[pDataFile->m_Header.m_NumRawData];
 	else
-		pReader->m_pDataFile->m_Info.m_pItemStart = (char *)&pReader->m_pDataFile->m_Info.m_pDataOffsets[pReader->m_pDataFile->m_Header.m_NumRawData];
-	pReader->m_pDataFile->m_Info.m_pDataStart = pReader->m_pDataFile->m_Info.m_pItemStart + pReader->m_pDataFile->m_Header.m_ItemSize;
-
-	libtw07_print("datafile", "loading done. datafile='%s'", pFilename);
-
-	return 0;
+		pDataFile->m_Info.m_pItemStart = (char *)&pDataFile->m_Info.m_pDataOffsets[pDataFile->m_Header.m_NumRawData];
+	pDataFile->m_Info.m_pDataStart = pDataFile->m_Info.m_pItemStart + pDataFile->m_Header.m_ItemSize;
 }
 
-int libtw07_datafile_reader_numData(libtw07_datafileReader *pReader)
+uint32_t _libtw07_datafile_hashKey(uint32_t Key)
 {
-	if(!pReader->m_pDataFile) { return 0; }
-	return pReader->m_pDataFile->m_Header.m_NumRawData;
+	return (Key * 2654435761u) ^ (Key >> 16);
 }
 
-int _libtw07_datafile_reader_getFileDataSize(libtw07_datafileReader *pReader, int Index)
+uint32_t _libtw07_datafile_hashSize(int Num)
 {
-	if(!pReader->m_pDataFile) { return 0; }
+	if(Num <= 0)
+		return 0;
+	uint32_t Size = 16;
+	while(Size < (uint32_t)Num * 2)
+		Size <<= 1;
+	return Size;
+}
 
-	if(Index == pReader->m_pDataFile->m_Header.m_NumRawData - 1)
-		return pReader->m_pDataFile->m_Header.m_DataSize - pReader->m_pDataFile->m_Info.m_pDataOffsets[Index];
-	return pReader->m_pDataFile->m_Info.m_pDataOffsets[Index + 1] - pReader->m_pDataFile->m_Info.m_pDataOffsets[Index];
+// returns the slot holding Key or the empty slot where it belongs
+libtw07_datafileIndexEntry *_libtw07_datafile_hashSlot(libtw07_datafileIndexEntry *pHash, uint32_t Mask, uint32_t Key)
+{
+	uint32_t Slot = _libtw07_datafile_hashKey(Key) & Mask;
+	while(pHash[Slot].m_Item && pHash[Slot].m_Key != Key)
+		Slot = (Slot + 1) & Mask;
+	return &pHash[Slot];
 }
 
-int libtw07_datafile_reader_getDataSize(libtw07_datafileReader *pReader, int Index)
+// builds a dense type table and (type, id) hash tables so type and item lookups are constant time
+void _libtw07_datafile_reader_buildIndex(libtw07_datafile *pDataFile)
 {
-	if(Index < 0 || Index >= pReader->m_pDataFile->m_Header.m_NumRawData)
+	int NumTypes = pDataFile->m_Header.m_NumItemTypes;
+	int NumItems = pDataFile->m_Header.m_NumItems;
+	libtw07_datafileItemType *pTypes = pDataFile->m_Info.m_pItemTypes;
+
+	int NumDense = 0;
+	int NumSparse = 0;
+	for(int i = 0; i < NumTypes; i++)
 	{
-		return 0;
+		if(pTypes[i].m_Type >= 0 && pTypes[i].m_Type < LIBTW07_DATAFILE_INDEX_DENSE_TYPES)
+			NumDense = libtw07_maximum(NumDense, pTypes[i].m_Type + 1);
+		else if(pTypes[i].m_Type >= LIBTW07_DATAFILE_INDEX_DENSE_TYPES && pTypes[i].m_Type <= 0xffff)
+			NumSparse++;
 	}
+	uint32_t TypeHashSize = _libtw07_datafile_hashSize(NumSparse);
+	uint32_t ItemHashSize = _libtw07_datafile_hashSize(NumItems);
 
-	if(!pReader->m_pDataFile->m_ppDataPtrs[Index])
+	libtw07_datafileIndexEntry *pIndex = (libtw07_datafileIndexEntry *) libtw07_allocator_alloc(&pDataFile->m_Allocator, (TypeHashSize + ItemHashSize) * sizeof(libtw07_datafileIndexEntry) + NumDense * sizeof(int) + 1);
+	if(!pIndex)
 	{
-		if(pReader->m_pDataFile->m_Header.m_Version >= 4)
-		{
-			return pReader->m_pDataFile->m_Info.m_pDataSizes[Index];
-		}
-		else
-		{
-			return _libtw07_datafile_reader_getFileDataSize(pReader, Index);
-		}
+		libtw07_print("datafile", "unable to allocate the item index, using linear lookups");
+		return;
 	}
-	return pReader->m_pDataFile->m_pDataSizes[Index];
-}
-
-void *_libtw07_datafile_reader_getDataImpl(libtw07_datafileReader *pReader, int Index, int Swap)
-{
-	if(!pReader->m_pDataFile) { return 0; }
-
-	if(Index < 0 || Index >= pReader->m_pDataFile->m_Header.m_NumRawData)
-		return 0;
+	libtw07_datafileIndexEntry *pTypeHash = pIndex;
+	libtw07_datafileIndexEntry *pItemHash = pIndex + TypeHashSize;
+	int *pTypeIndices = (int *)(pItemHash + ItemHashSize);
+	memset(pIndex, 0, (TypeHashSize + ItemHashSize) * sizeof(libtw07_datafileIndexEntry));
+	memset(pTypeIndices, 0xff, NumDense * sizeof(int));
 
-	// load it if needed
-	if(!pReader->m_pDataFile->m_ppDataPtrs[Index])
+	for(int i = 0; i < NumTypes; i++)
 	{
-		// fetch the data size
-		int DataSize = libtw07_datafile_reader_getDataSize(pReader, Index);
-#if defined(CONF_ARCH_ENDIAN_BIG)
-		int SwapSize = DataSize;
-#endif
+		int Type = pTypes[i].m_Type;
+		if(Type < 0 || Type > 0xffff)
+			continue;
 
-		if(pReader->m_pDataFile->m_Header.m_Version == 4)
+		// the first entry of a type wins, as with a linear scan
+		if(Type < LIBTW07_DATAFILE_INDEX_DENSE_TYPES)
 		{
-			// v4 has compressed data
-			void *pTemp = malloc(DataSize);
-			unsigned long UncompressedSize = pReader->m_pDataFile->m_Info.m_pDataSizes[Index];
-			unsigned long s;
-
-			libtw07_print("datafile", "loading data index=%d size=%d uncompressed=%lu", Index, DataSize, UncompressedSize);
-			pReader->m_pDataFile->m_ppDataPtrs[Index] = (char *) malloc(UncompressedSize);
-			pReader->m_pDataFile->m_pDataSizes[Index] = UncompressedSize;
-
-			// read the compressed data
-			fseek(pReader->m_pDataFile->m_File, pReader->m_pDataFile->m_DataStartOffset+pReader->m_pDataFile->m_Info.m_pDataOffsets[Index], SEEK_SET);
-			fread(pTemp, 1, DataSize, pReader->m_pDataFile->m_File);
-
-			// decompress the data, TODO: check for errors
-			s = UncompressedSize;
-			uncompress((Bytef*)pReader->m_pDataFile->m_ppDataPtrs[Index], &s, (Bytef*)pTemp, DataSize);
-#if defined(CONF_ARCH_ENDIAN_BIG)
-			SwapSize = s;
-#endif
-
-			// clean up the temporary buffers
-			free(pTemp);
+			if(pTypeIndices[Type] != -1)
+				continue;
+			pTypeIndices[Type] = i;
 		}
 		else
 		{
-			// load the data
-			libtw07_print("datafile", "loading data index=%d size=%d", Index, DataSize);
-			pReader->m_pDataFile->m_ppDataPtrs[Index] = (char *) malloc(DataSize);
-			pReader->m_pDataFile->m_pDataSizes[Index] = DataSize;
-			fseek(pReader->m_pDataFile->m_File, pReader->m_pDataFile->m_DataStartOffset + pReader->m_pDataFile->m_Info.m_pDataOffsets[Index], SEEK_SET);
-			fread(pReader->m_pDataFile->m_ppDataPtrs[Index], 1, DataSize, pReader->m_pDataFile->m_File);
+			libtw07_datafileIndexEntry *pEntry = _libtw07_datafile_hashSlot(pTypeHash, TypeHashSize - 1, Type);
+			if(pEntry->m_Item)
+				continue;
+			pEntry->m_Key = Type;
+			pEntry->m_Item = i + 1;
 		}
 
-#if defined(CONF_ARCH_ENDIAN_BIG)
-		if(Swap && SwapSize)
-			swap_endian(pReader->m_pDataFile->m_ppDataPtrs[Index], sizeof(int), SwapSize/sizeof(int));
-#endif
+		for(int k = 0; k < pTypes[i].m_Num; k++)
+		{
+			int Index = pTypes[i].m_Start + k;
+			if(Index < 0 || Index >= NumItems)
+				break;
+
+			// the offsets come from the file, skip items whose header lies outside the item section
+			int Offset = pDataFile->m_Info.m_pItemOffsets[Index];
+			if(Offset < 0 || (int64_t)Offset + (int64_t)sizeof(libtw07_datafileItem) > pDataFile->m_Header.m_ItemSize)
+				continue;
+
+			libtw07_datafileItem *pItem = (libtw07_datafileItem *) (pDataFile->m_Info.m_pItemStart + Offset);
+			uint32_t Key = ((uint32_t)Type << 16) | (pItem->m_TypeAndID & 0xffff);
+			libtw07_datafileIndexEntry *pEntry = _libtw07_datafile_hashSlot(pItemHash, ItemHashSize - 1, Key);
+			if(!pEntry->m_Item) // keep the first item with this id
+			{
+				pEntry->m_Key = Key;
+				pEntry->m_Item = Index + 1;
+			}
+		}
 	}
 
-	return pReader->m_pDataFile->m_ppDataPtrs[Index];
+	pDataFile->m_NumTypeIndices = NumDense;
+	pDataFile->m_pTypeIndices = pTypeIndices;
+	pDataFile->m_TypeHashMask = TypeHashSize - 1;
+	pDataFile->m_pTypeHash = TypeHashSize ? pTypeHash : 0;
+	pDataFile->m_ItemHashMask = ItemHashSize - 1;
+	pDataFile->m_pItemHash = ItemHashSize ? pItemHash : 0;
+	pDataFile->m_pIndex = pIndex;
 }
 
-void *libtw07_datafile_reader_getData(libtw07_datafileReader *pReader, int Index)
+// index into m_Info.m_pItemTypes or -1
+int _libtw07_datafile_reader_findType(libtw07_datafile *pDataFile, int Type)
 {
-	return _libtw07_datafile_reader_getDataImpl(pReader, Index, 0);
+	if(Type < 0 || Type > 0xffff)
+		return -1;
+	if(Type < LIBTW07_DATAFILE_INDEX_DENSE_TYPES)
+		return Type < pDataFile->m_NumTypeIndices ? pDataFile->m_pTypeIndices[Type] : -1;
+	if(!pDataFile->m_pTypeHash)
+		return -1;
+	return _libtw07_datafile_hashSlot(pDataFile->m_pTypeHash, pDataFile->m_TypeHashMask, Type)->m_Item - 1;
 }
 
-void *libtw07_datafile_reader_getDataSwapped(libtw07_datafileReader *pReader, int Index)
+enum
 {
-	return _libtw07_datafile_reader_getDataImpl(pReader, Index, 1);
-}
+	LIBTW07_DATAFILE_ADVICE_NORMAL=0,
+	LIBTW07_DATAFILE_ADVICE_SEQUENTIAL,
+	LIBTW07_DATAFILE_ADVICE_RANDOM,
+	LIBTW07_DATAFILE_ADVICE_WILLNEED,
+};
 
-void libtw07_datafile_reader_unloadData(libtw07_datafileReader *pReader,int Index)
+// passes an access pattern hint for a region of the mapped file to the kernel
+void _libtw07_datafile_reader_advise(libtw07_datafile *pDataFile, int64_t Offset, int64_t Size, int Advice)
 {
-	if(Index < 0 || Index >= pReader->m_pDataFile->m_Header.m_NumRawData)
+#if defined(LIBTW07_DATAFILE_POSIX)
+	// only file mappings, memory buffers belong to the caller
+	if(pDataFile->m_Mapping != LIBTW07_DATAFILE_MAPPING_MMAP || Size <= 0)
 		return;
 
-	free(pReader->m_pDataFile->m_ppDataPtrs[Index]);
-	pReader->m_pDataFile->m_ppDataPtrs[Index] = 0x0;
-	pReader->m_pDataFile->m_pDataSizes[Index] = 0;
-}
-
-void libtw07_datafile_reader_replaceData(libtw07_datafileReader *pReader, int Index, char *pData, int Size)
-{
-	if(Index < 0 || Index >= pReader->m_pDataFile->m_Header.m_NumRawData)
+	int64_t PageSize = sysconf(_SC_PAGESIZE);
+	int64_t Start = Offset & ~(PageSize-1);
+	int64_t End = Offset + Size;
+	if(End <= Start)
 		return;
 
-	// make sure the data has been loaded
-	_libtw07_datafile_reader_getDataImpl(pReader, Index, 0);
-
-	libtw07_datafile_reader_unloadData(pReader, Index);
-	pReader->m_pDataFile->m_ppDataPtrs[Index] = pData;
-	pReader->m_pDataFile->m_pDataSizes[Index] = Size;
+	switch(Advice)
+	{
+	case LIBTW07_DATAFILE_ADVICE_SEQUENTIAL: posix_madvise(pDataFile->m_pMapped + Start, End - Start, POSIX_MADV_SEQUENTIAL); break;
+	case LIBTW07_DATAFILE_ADVICE_RANDOM: posix_madvise(pDataFile->m_pMapped + Start, End - Start, POSIX_MADV_RANDOM); break;
+	case LIBTW07_DATAFILE_ADVICE_WILLNEED: posix_madvise(pDataFile->m_pMapped + Start, End - Start, POSIX_MADV_WILLNEED); break;
+	default: posix_madvise(pDataFile->m_pMapped + Start, End - Start, POSIX_MADV_NORMAL);
+	}
+#else
+	(void)pDataFile; (void)Offset; (void)Size; (void)Advice;
+#endif
 }
 
-int _libtw07_datafile_reader_getFileItemSize(libtw07_datafileReader *pReader, int Index)
+// seeks with a 64 bit offset, fseek only takes a long which is 32 bits on windows.
+// offsets the platform can not reach fail instead of landing somewhere else
+int _libtw07_datafile_seek(FILE *File, int64_t Offset)
 {
-	if(!pReader->m_pDataFile) { return 0; }
-	if(Index == pReader->m_pDataFile->m_Header.m_NumItems-1)
-		return pReader->m_pDataFile->m_Header.m_ItemSize - pReader->m_pDataFile->m_Info.m_pItemOffsets[Index];
-	return pReader->m_pDataFile->m_Info.m_pItemOffsets[Index+1] - pReader->m_pDataFile->m_Info.m_pItemOffsets[Index];
+#if defined(LIBTW07_DATAFILE_POSIX)
+	if((int64_t)(off_t)Offset != Offset)
+		return -1;
+	return fseeko(File, (off_t)Offset, SEEK_SET);
+#elif defined(CONF_FAMILY_WINDOWS)
+	return _fseeki64(File, Offset, SEEK_SET);
+#else
+	if(Offset > LONG_MAX)
+		return -1;
+	return fseek(File, (long)Offset, SEEK_SET);
+#endif
 }
 
-int libtw07_datafile_reader_getItemSize(libtw07_datafileReader *pReader, int Index)
+// positional read that leaves the file position alone, so any number of threads can read at once
+int64_t _libtw07_datafile_reader_readAt(libtw07_datafile *pDataFile, int64_t Offset, void *pDst, int64_t Size)
 {
-	int FileSize = _libtw07_datafile_reader_getFileItemSize(pReader, Index);
-	if(FileSize == 0)
+	int64_t Total = 0;
+#if defined(LIBTW07_DATAFILE_POSIX)
+	int Fd = fileno(pDataFile->m_File);
+	while(Total < Size)
 	{
-		return 0;
+		ssize_t Bytes = pread(Fd, (char *)pDst + Total, Size - Total, Offset + Total);
+		if(Bytes < 0 && errno == EINTR)
+			continue;
+		if(Bytes <= 0)
+			break;
+		Total += Bytes;
 	}
-	return FileSize - sizeof(libtw07_datafileItem);
-}
-
-void *libtw07_datafile_reader_getItem(libtw07_datafileReader *pReader, int Index, int *pType, int *pID)
-{
-	if(!pReader->m_pDataFile || Index < 0 || Index >= pReader->m_pDataFile->m_Header.m_NumItems)
+#elif defined(CONF_FAMILY_WINDOWS)
+	HANDLE File = (HANDLE)_get_osfhandle(_fileno(pDataFile->m_File));
+	while(Total < Size)
 	{
-		if(pType)
-			*pType = 0;
-		if(pID)
-			*pID = 0;
-
-		return 0;
+		OVERLAPPED Overlapped;
+		memset(&Overlapped, 0, sizeof(Overlapped));
+		Overlapped.Offset = (DWORD)(Offset + Total);
+		Overlapped.OffsetHigh = (DWORD)((Offset + Total) >> 32);
+		DWORD Bytes = 0;
+		DWORD Wanted = (DWORD)libtw07_minimum(Size - Total, (int64_t)0x40000000);
+		if(!ReadFile(File, (char *)pDst + Total, Wanted, &Bytes, &Overlapped) || Bytes == 0)
+			break;
+		Total += Bytes;
 	}
-
-	libtw07_datafileItem *i = (libtw07_datafileItem *) (pReader->m_pDataFile->m_Info.m_pItemStart + pReader->m_pDataFile->m_Info.m_pItemOffsets[Index]);
-	if(pType)
-		*pType = (i->m_TypeAndID>>16)&0xffff; // remove sign extention
-	if(pID)
-		*pID = i->m_TypeAndID&0xffff;
-	return (void *)(i+1);
+#else
+	// no positional reads, the seek and the read have to stay together
+	libtw07_lock_wait(&pDataFile->m_ReadLock);
+	if(_libtw07_datafile_seek(pDataFile->m_File, Offset) == 0)
+		Total = fread(pDst, 1, Size, pDataFile->m_File);
+	libtw07_lock_unlock(&pDataFile->m_ReadLock);
+#endif
+	return Total;
 }
 
-void libtw07_datafile_reader_getType(libtw07_datafileReader *pReader, int Type, int *pStart, int *pNum)
+// takes the hashes of the whole file, used when they were not taken while opening
+void _libtw07_datafile_reader_hashFile(libtw07_datafile *pDataFile)
 {
-	*pStart = 0;
-	*pNum = 0;
+	SHA256_CTX Sha256Ctx;
+	sha256_init(&Sha256Ctx);
+	uint32_t Crc = crc32(0L, 0x0, 0);
 
-	if(!pReader->m_pDataFile)
-		return;
+	if(pDataFile->m_pMapped)
+	{
+		_libtw07_datafile_reader_advise(pDataFile, 0, pDataFile->m_MappedSize, LIBTW07_DATAFILE_ADVICE_SEQUENTIAL);
+		sha256_update(&Sha256Ctx, pDataFile->m_pMapped, pDataFile->m_MappedSize);
+		Crc = crc32(Crc, pDataFile->m_pMapped, pDataFile->m_MappedSize);
 
-	for(int i = 0; i < pReader->m_pDataFile->m_Header.m_NumItemTypes; i++)
+		// back to on demand access. the pages stay, zero-copy blocks handed out before may point into them
+		int64_t DataStart = pDataFile->m_DataStartOffset;
+		_libtw07_datafile_reader_advise(pDataFile, DataStart, pDataFile->m_MappedSize - DataStart, LIBTW07_DATAFILE_ADVICE_RANDOM);
+	}
+	else if(pDataFile->m_File)
 	{
-		if(pReader->m_pDataFile->m_Info.m_pItemTypes[i].m_Type == Type)
+		enum
 		{
-			*pStart = pReader->m_pDataFile->m_Info.m_pItemTypes[i].m_Start;
-			*pNum = pReader->m_pDataFile->m_Info.m_pItemTypes[i].m_Num;
-			return;
+			BUFFER_SIZE = 64*1024
+		};
+
+		unsigned char aBuffer[BUFFER_SIZE];
+
+		int64_t Offset = 0;
+		while(1)
+		{
+			int64_t Bytes = _libtw07_datafile_reader_readAt(pDataFile, Offset, aBuffer, BUFFER_SIZE);
+			if(Bytes <= 0)
+				break;
+			sha256_update(&Sha256Ctx, aBuffer, Bytes);
+			Crc = crc32(Crc, aBuffer, Bytes);
+			Offset += Bytes;
 		}
 	}
+
+	pDataFile->m_Sha256 = sha256_finish(&Sha256Ctx);
+	pDataFile->m_Crc = Crc;
+	libtw07_atomic_store(&pDataFile->m_Hashed, 1);
 }
 
-void *libtw07_datafile_reader_findItem(libtw07_datafileReader *pReader, int Type, int ID)
+// opens a datafile that is fully in memory, the item section and uncompressed data are used in place.
+// on failure the buffer is left to the caller, whatever Mapping says
+int _libtw07_datafile_reader_openMapping(libtw07_datafileReader *pReader, unsigned char *pMapped, int64_t FileSize, int Mapping, int Flags)
 {
-	if(!pReader->m_pDataFile) return 0;
-
-	int Start, Num;
-	libtw07_datafile_reader_getType(pReader, Type, &Start, &Num);
-	for(int i = 0; i < Num; i++)
+	libtw07_datafileHeader Header;
+	int64_t Size;
+	if(FileSize < (int64_t)sizeof(libtw07_datafileHeader))
+	{
+		libtw07_print("datafile", "unable to load file, file too small");
+		return -1;
+	}
+	memcpy(&Header, pMapped, sizeof(Header));
+	if(_libtw07_datafile_reader_checkHeader(&Header, &Size) != 0 || (int64_t)sizeof(libtw07_datafileHeader) + Size > FileSize)
+	{
+		libtw07_print("datafile", "unable to load file, invalid file information");
+		return -1;
+	}
+
+	int64_t AllocSize;
+	libtw07_datafile *pTmpDataFile = _libtw07_datafile_reader_allocDataFile(pReader, &Header, 0, &AllocSize);
+	if(!pTmpDataFile)
+		return -1;
+	pTmpDataFile->m_pMapped = pMapped;
+	pTmpDataFile->m_MappedSize = FileSize;
+	pTmpDataFile->m_Mapping = Mapping;
+	pTmpDataFile->m_Flags = Flags;
+	pTmpDataFile->m_DataStartOffset = sizeof(libtw07_datafileHeader) + Size;
+	pTmpDataFile->m_pData = (char *)(pMapped + sizeof(libtw07_datafileHeader)); // types, offsets, sizes and item data stay in the mapping
+
+	// take the hashes of the file and store them
+	if(!(Flags&(LIBTW07_DATAFILE_OPENFLAG_HASH_LAZY|LIBTW07_DATAFILE_OPENFLAG_HASH_NONE)))
+		_libtw07_datafile_reader_hashFile(pTmpDataFile);
+
+	libtw07_datafile_reader_close(pReader);
+	pReader->m_pDataFile = pTmpDataFile;
+
+#if defined(CONF_ARCH_ENDIAN_BIG)
+	swap_endian(pReader->m_pDataFile->m_pData, sizeof(int), libtw07_minimum((uint32_t) Header.m_Swaplen, (uint32_t) Size) / sizeof(int));
+#endif
+
+	_libtw07_datafile_reader_setupInfo(pReader->m_pDataFile);
+	_libtw07_datafile_reader_buildIndex(pReader->m_pDataFile);
+
+	// the data is only touched on demand, stop the kernel from reading ahead
+	int64_t DataStart = pReader->m_pDataFile->m_DataStartOffset;
+	_libtw07_datafile_reader_advise(pReader->m_pDataFile, DataStart, FileSize - DataStart, LIBTW07_DATAFILE_ADVICE_RANDOM);
+
+	libtw07_print("datafile", "allocsize=%d", (uint32_t) AllocSize);
+	libtw07_print("datafile", "mapsize=%d", (uint32_t) FileSize);
+	return 0;
+}
+
+#if defined(LIBTW07_DATAFILE_POSIX)
+int _libtw07_datafile_reader_openMapped(libtw07_datafileReader *pReader, const char *pFilename, int Flags)
+{
+	int Fd = open(pFilename, O_RDONLY);
+	if(Fd < 0)
+	{
+		libtw07_print("datafile", "could not open '%s'", pFilename);
+		return -1;
+	}
+
+	struct stat Stat;
+	if(fstat(Fd, &Stat) != 0 || Stat.st_size < (off_t)sizeof(libtw07_datafileHeader))
+	{
+		close(Fd);
+		libtw07_print("datafile", "could not map '%s', file too small", pFilename);
+		return -1;
+	}
+	int64_t FileSize = Stat.st_size;
+
+#if defined(CONF_ARCH_ENDIAN_BIG)
+	int Prot = PROT_READ|PROT_WRITE; // private mapping, swapping only touches our copy of the pages
+#else
+	int Prot = PROT_READ;
+#endif
+	unsigned char *pMapped = (unsigned char *) mmap(0, FileSize, Prot, MAP_PRIVATE, Fd, 0);
+	close(Fd);
+	if(pMapped == MAP_FAILED)
+	{
+		libtw07_print("datafile", "could not map '%s'", pFilename);
+		return -1;
+	}
+
+	if(_libtw07_datafile_reader_openMapping(pReader, pMapped, FileSize, LIBTW07_DATAFILE_MAPPING_MMAP, Flags) != 0)
+	{
+		munmap(pMapped, FileSize);
+		return -1;
+	}
+
+	libtw07_print("datafile", "loading done. datafile='%s'", pFilename);
+	return 0;
+}
+#endif
+
+// opens a datafile from a buffer without any file io, the buffer is parsed in place.
+// on big endian machines the item section and v3 data are swapped inside the buffer
+int libtw07_datafile_reader_openMemory(libtw07_datafileReader *pReader, void *pData, int64_t Size, int Ownership)
+{
+	return libtw07_datafile_reader_openMemoryEx(pReader, pData, Size, Ownership, 0);
+}
+
+// takes the hash flags of openEx, the buffer is always used in place so LIBTW07_DATAFILE_OPENFLAG_MMAP does nothing
+int libtw07_datafile_reader_openMemoryEx(libtw07_datafileReader *pReader, void *pData, int64_t Size, int Ownership, int Flags)
+{
+	libtw07_print("datafile", "loading. memory size=%lld", (long long) Size);
+
+	int Mapping = Ownership == LIBTW07_DATAFILE_MEMORY_TAKE ? LIBTW07_DATAFILE_MAPPING_OWNED : LIBTW07_DATAFILE_MAPPING_BORROWED;
+	if(!pData || _libtw07_datafile_reader_openMapping(pReader, (unsigned char *)pData, Size, Mapping, Flags&~LIBTW07_DATAFILE_OPENFLAG_MMAP) != 0)
+		return -1;
+
+	libtw07_print("datafile", "loading done. datafile from memory");
+	return 0;
+}
+
+int libtw07_datafile_reader_open(libtw07_datafileReader *pReader, const char *pFilename)
+{
+	return libtw07_datafile_reader_openEx(pReader, pFilename, 0);
+}
+
+int libtw07_datafile_reader_openEx(libtw07_datafileReader *pReader, const char *pFilename, int Flags)
+{
+	libtw07_print("datafile", "loading. filename='%s'", pFilename);
+
+	if(Flags&LIBTW07_DATAFILE_OPENFLAG_MMAP)
+	{
+#if defined(LIBTW07_DATAFILE_POSIX)
+		return _libtw07_datafile_reader_openMapped(pReader, pFilename, Flags);
+#else
+		libtw07_print("datafile", "memory mapping is not supported on this platform, reading the file instead");
+		Flags &= ~LIBTW07_DATAFILE_OPENFLAG_MMAP;
+#endif
+	}
+
+	FILE *File = fopen(pFilename, "rb");
+	if(!File)
+	{
+		libtw07_print("datafile", "could not open '%s'", pFilename);
+		return -1;
+	}
+
+
+	// the hashes are taken while the file is read, every byte is read once
+	int Hash = !(Flags&(LIBTW07_DATAFILE_OPENFLAG_HASH_LAZY|LIBTW07_DATAFILE_OPENFLAG_HASH_NONE));
+	SHA256_CTX Sha256Ctx;
+	sha256_init(&Sha256Ctx);
+	uint32_t Crc = crc32(0L, 0x0, 0);
+
+	libtw07_datafileHeader Header;
+	int64_t Size;
+	if(fread(&Header, 1, sizeof(Header), File) != sizeof(Header))
+	{
+		fclose(File);
+		libtw07_print("datafile", "couldn't read the header");
+		return -1;
+	}
+	if(Hash)
+	{
+		sha256_update(&Sha256Ctx, &Header, sizeof(Header));
+		Crc = crc32(Crc, (const unsigned char *)&Header, sizeof(Header));
+	}
+	if(_libtw07_datafile_reader_checkHeader(&Header, &Size) != 0)
+	{
+		fclose(File);
+		return -1;
+	}
+
+	// read in the rest except the data
+	int64_t AllocSize;
+	libtw07_datafile *pTmpDataFile = _libtw07_datafile_reader_allocDataFile(pReader, &Header, Size, &AllocSize);
+	if(!pTmpDataFile)
+	{
+		fclose(File);
+		return -1;
+	}
+	pTmpDataFile->m_File = File;
+	pTmpDataFile->m_Flags = Flags;
+
+	// read types, offsets, sizes and item data
+	uint32_t ReadSize = fread(pTmpDataFile->m_pData, 1, Size, File);
+	if(ReadSize != Size)
+	{
+		fclose(pTmpDataFile->m_File);
+		_libtw07_datafile_reader_freeDataFile(pTmpDataFile);
+		pTmpDataFile = 0;
+		libtw07_print("datafile", "couldn't load the whole thing, wanted=%d got=%d", (uint32_t) Size, ReadSize);
+		return -1;
+	}
+
+	// hash what was read so far and stream the data through the hashes
+	if(Hash)
+	{
+		sha256_update(&Sha256Ctx, pTmpDataFile->m_pData, Size);
+		Crc = crc32(Crc, (const unsigned char *)pTmpDataFile->m_pData, Size);
+
+		enum
+		{
+			BUFFER_SIZE = 64*1024
+		};
+
+		unsigned char aBuffer[BUFFER_SIZE];
+
+		while(1)
+		{
+			unsigned Bytes = fread(aBuffer, 1, BUFFER_SIZE, File);
+			if(Bytes == 0)
+				break;
+			sha256_update(&Sha256Ctx, aBuffer, Bytes);
+			Crc = crc32(Crc, aBuffer, Bytes);
+		}
+
+		pTmpDataFile->m_Sha256 = sha256_finish(&Sha256Ctx);
+		pTmpDataFile->m_Crc = Crc;
+		pTmpDataFile->m_Hashed = 1;
+	}
+
+	libtw07_datafile_reader_close(pReader);
+	pReader->m_pDataFile = pTmpDataFile;
+
+#if defined(CONF_ARCH_ENDIAN_BIG)
+	swap_endian(pReader->m_pDataFile->m_pData, sizeof(int), libtw07_minimum((uint32_t) Header.m_Swaplen, (uint32_t) Size) / sizeof(int));
+#endif
+
+	//if(LIBTW07_DATAFILE_DEBUG)
+	{
+		libtw07_print("datafile", "allocsize=%d", (uint32_t) AllocSize);
+		libtw07_print("datafile", "readsize=%d", ReadSize);
+		libtw07_print("datafile", "swaplen=%d", Header.m_Swaplen);
+		libtw07_print("datafile", "item_size=%d", pReader->m_pDataFile->m_Header.m_ItemSize);
+	}
+
+	_libtw07_datafile_reader_setupInfo(pReader->m_pDataFile);
+	_libtw07_datafile_reader_buildIndex(pReader->m_pDataFile);
+
+	libtw07_print("datafile", "loading done. datafile='%s'", pFilename);
+
+	return 0;
+}
+
+int libtw07_datafile_reader_numData(libtw07_datafileReader *pReader)
+{
+	if(!pReader->m_pDataFile) { return 0; }
+	return pReader->m_pDataFile->m_Header.m_NumRawData;
+}
+
+int _libtw07_datafile_reader_getFileDataSize(libtw07_datafileReader *pReader, int Index)
+{
+	if(!pReader->m_pDataFile) { return 0; }
+
+	if(Index == pReader->m_pDataFile->m_Header.m_NumRawData - 1)
+		return pReader->m_pDataFile->m_Header.m_DataSize - pReader->m_pDataFile->m_Info.m_pDataOffsets[Index];
+	return pReader->m_pDataFile->m_Info.m_pDataOffsets[Index + 1] - pReader->m_pDataFile->m_Info.m_pDataOffsets[Index];
+}
+
+int libtw07_datafile_reader_getDataSize(libtw07_datafileReader *pReader, int Index)
+{
+	if(Index < 0 || Index >= pReader->m_pDataFile->m_Header.m_NumRawData)
+	{
+		return 0;
+	}
+
+	if(libtw07_atomic_load(&pReader->m_pDataFile->m_pDataStates[Index]) != LIBTW07_DATAFILE_DATASTATE_LOADED)
+	{
+		if(pReader->m_pDataFile->m_Header.m_Version >= 4)
+		{
+			return pReader->m_pDataFile->m_Info.m_pDataSizes[Index];
+		}
+		else
+		{
+			return _libtw07_datafile_reader_getFileDataSize(pReader, Index);
+		}
+	}
+	return pReader->m_pDataFile->m_pDataSizes[Index];
+}
+
+// returns the block in the mapped file or 0 when the file is not mapped or the block is out of bounds
+unsigned char *_libtw07_datafile_reader_mapData(libtw07_datafile *pDataFile, int Index, int DataSize)
+{
+	if(!pDataFile->m_pMapped)
+		return 0;
+
+	int64_t Offset = pDataFile->m_DataStartOffset + (int64_t)pDataFile->m_Info.m_pDataOffsets[Index];
+	if(DataSize < 0 || pDataFile->m_Info.m_pDataOffsets[Index] < 0 || Offset + DataSize > pDataFile->m_MappedSize)
+	{
+		libtw07_print("datafile", "data index=%d is out of bounds", Index);
+		return 0;
+	}
+	_libtw07_datafile_reader_advise(pDataFile, Offset, DataSize, LIBTW07_DATAFILE_ADVICE_WILLNEED);
+	return pDataFile->m_pMapped + Offset;
+}
+
+// reads the block as it is stored in the file
+int _libtw07_datafile_reader_readData(libtw07_datafile *pDataFile, int Index, void *pDst, int DataSize)
+{
+	if(_libtw07_datafile_reader_readAt(pDataFile, pDataFile->m_DataStartOffset + (int64_t)pDataFile->m_Info.m_pDataOffsets[Index], pDst, DataSize) != DataSize)
+		return -1;
+	return 0;
+}
+
+void *_libtw07_datafile_zalloc(void *pOpaque, size_t Items, size_t Size)
+{
+	return libtw07_allocator_alloc((const libtw07_allocator *)pOpaque, Items * Size);
+}
+
+void _libtw07_datafile_zfree(void *pOpaque, void *pAddress)
+{
+	libtw07_allocator_free((const libtw07_allocator *)pOpaque, pAddress);
+}
+
+// same as uncompress, but the inflate state comes from the allocator
+int _libtw07_datafile_uncompress(const libtw07_allocator *pAllocator, void *pDst, unsigned long *pDstSize, const void *pSrc, int SrcSize)
+{
+	mz_stream Stream;
+	memset(&Stream, 0, sizeof(Stream));
+	Stream.next_in = (const unsigned char *)pSrc;
+	Stream.avail_in = SrcSize;
+	Stream.next_out = (unsigned char *)pDst;
+	Stream.avail_out = *pDstSize;
+	Stream.zalloc = _libtw07_datafile_zalloc;
+	Stream.zfree = _libtw07_datafile_zfree;
+	Stream.opaque = (void *)pAllocator;
+
+	int Result = mz_inflateInit(&Stream);
+	if(Result != MZ_OK)
+		return Result;
+
+	Result = mz_inflate(&Stream, MZ_FINISH);
+	*pDstSize = Stream.total_out;
+	mz_inflateEnd(&Stream);
+	if(Result == MZ_STREAM_END)
+		return MZ_OK;
+	return (Result == MZ_BUF_ERROR && Stream.avail_in == 0) ? MZ_DATA_ERROR : Result;
+}
+
+enum
+{
+	LIBTW07_DATAFILE_INFLATE_WINDOW=16*1024,
+};
+
+// inflates a v4 block straight into pDst. the compressed bytes are taken from pSrc, or read through
+// a small window on the stack when it is 0. returns the number of bytes written or -1
+int _libtw07_datafile_reader_inflateInto(libtw07_datafile *pDataFile, int Index, const unsigned char *pSrc, int SrcSize, void *pDst, int DstSize)
+{
+	tinfl_decompressor Inflator;
+	tinfl_init(&Inflator);
+	unsigned char aWindow[LIBTW07_DATAFILE_INFLATE_WINDOW];
+
+	int64_t ReadOffset = pDataFile->m_DataStartOffset + (int64_t)pDataFile->m_Info.m_pDataOffsets[Index];
+	int SrcLeft = SrcSize;
+	const unsigned char *pIn = 0;
+	size_t InAvail = 0;
+	size_t OutPos = 0;
+	while(1)
+	{
+		if(InAvail == 0 && SrcLeft > 0)
+		{
+			if(pSrc)
+			{
+				pIn = pSrc;
+				InAvail = SrcLeft;
+			}
+			else
+			{
+				InAvail = libtw07_minimum(SrcLeft, (int)sizeof(aWindow));
+				if(_libtw07_datafile_reader_readAt(pDataFile, ReadOffset, aWindow, InAvail) != (int64_t)InAvail)
+					return -1;
+				ReadOffset += InAvail;
+				pIn = aWindow;
+			}
+			SrcLeft -= InAvail;
+		}
+
+		size_t InSize = InAvail;
+		size_t OutSize = DstSize - OutPos;
+		mz_uint32 Flags = TINFL_FLAG_PARSE_ZLIB_HEADER|TINFL_FLAG_USING_NON_WRAPPING_OUTPUT_BUF;
+		if(SrcLeft > 0)
+			Flags |= TINFL_FLAG_HAS_MORE_INPUT;
+		tinfl_status Status = tinfl_decompress(&Inflator, pIn, &InSize, (mz_uint8 *)pDst, (mz_uint8 *)pDst + OutPos, &OutSize, Flags);
+		pIn += InSize;
+		InAvail -= InSize;
+		OutPos += OutSize;
+
+		if(Status == TINFL_STATUS_DONE)
+			return (int)OutPos;
+		// more output means the destination is too small
+		if(Status != TINFL_STATUS_NEEDS_MORE_INPUT)
+			return -1;
+	}
+}
+
+// loads a block, the caller has to own its LOADING state
+void *_libtw07_datafile_reader_loadBlock(libtw07_datafileReader *pReader, int Index, int Swap)
+{
+	// fetch the size of the data in the file
+	int DataSize = _libtw07_datafile_reader_getFileDataSize(pReader, Index);
+#if defined(CONF_ARCH_ENDIAN_BIG)
+	int SwapSize = DataSize;
+#endif
+	unsigned char *pMapped = 0;
+	if(pReader->m_pDataFile->m_pMapped)
+	{
+		// the block is used straight from the mapping
+		pMapped = _libtw07_datafile_reader_mapData(pReader->m_pDataFile, Index, DataSize);
+		if(!pMapped)
+			return 0;
+	}
+
+	if(pReader->m_pDataFile->m_Header.m_Version == 4)
+	{
+		// v4 has compressed data
+		int UncompressedSize = pReader->m_pDataFile->m_Info.m_pDataSizes[Index];
+
+		libtw07_print("datafile", "loading data index=%d size=%d uncompressed=%d", Index, DataSize, UncompressedSize);
+		char *pData = (char *) libtw07_allocator_alloc(&pReader->m_pDataFile->m_Allocator, UncompressedSize);
+		if(!pData)
+			return 0;
+
+		// decompress the data, the compressed bytes are streamed in when the file is not mapped
+		int s = _libtw07_datafile_reader_inflateInto(pReader->m_pDataFile, Index, pMapped, DataSize, pData, UncompressedSize);
+		if(s < 0)
+		{
+			libtw07_print("datafile", "failed to decompress data index=%d", Index);
+			libtw07_allocator_free(&pReader->m_pDataFile->m_Allocator, pData);
+			return 0;
+		}
+		pReader->m_pDataFile->m_ppDataPtrs[Index] = pData;
+		pReader->m_pDataFile->m_pDataSizes[Index] = UncompressedSize;
+#if defined(CONF_ARCH_ENDIAN_BIG)
+		SwapSize = s;
+#endif
+	}
+	else if(pMapped)
+	{
+		libtw07_print("datafile", "mapping data index=%d size=%d", Index, DataSize);
+		pReader->m_pDataFile->m_ppDataPtrs[Index] = (char *) pMapped;
+		pReader->m_pDataFile->m_pDataSizes[Index] = DataSize;
+		pReader->m_pDataFile->m_pDataFlags[Index] |= LIBTW07_DATAFILE_DATAFLAG_BORROWED;
+	}
+	else
+	{
+		// load the data
+		libtw07_print("datafile", "loading data index=%d size=%d", Index, DataSize);
+		if(DataSize < 0)
+			return 0;
+		char *pData = (char *) libtw07_allocator_alloc(&pReader->m_pDataFile->m_Allocator, DataSize + 1);
+		if(!pData)
+			return 0;
+		if(_libtw07_datafile_reader_readData(pReader->m_pDataFile, Index, pData, DataSize) != 0)
+		{
+			libtw07_print("datafile", "failed to read data index=%d", Index);
+			libtw07_allocator_free(&pReader->m_pDataFile->m_Allocator, pData);
+			return 0;
+		}
+		pReader->m_pDataFile->m_ppDataPtrs[Index] = pData;
+		pReader->m_pDataFile->m_pDataSizes[Index] = DataSize;
+	}
+
+#if defined(CONF_ARCH_ENDIAN_BIG)
+	if(Swap && SwapSize)
+		swap_endian(pReader->m_pDataFile->m_ppDataPtrs[Index], sizeof(int), SwapSize/sizeof(int));
+#endif
+
+	return pReader->m_pDataFile->m_ppDataPtrs[Index];
+}
+
+int64_t _libtw07_datafile_reader_residentSize(libtw07_datafile *pDataFile, int Index)
+{
+	if(pDataFile->m_pDataFlags[Index]&LIBTW07_DATAFILE_DATAFLAG_BORROWED)
+		return 0;
+	return pDataFile->m_pDataSizes[Index];
+}
+
+// the cache lock must be held for all of these
+void _libtw07_datafile_cache_link(libtw07_datafileCache *pCache, int Index)
+{
+	pCache->m_pPrev[Index] = pCache->m_Last;
+	pCache->m_pNext[Index] = -1;
+	if(pCache->m_Last != -1)
+		pCache->m_pNext[pCache->m_Last] = Index;
+	else
+		pCache->m_First = Index;
+	pCache->m_Last = Index;
+}
+
+void _libtw07_datafile_cache_unlink(libtw07_datafileCache *pCache, int Index)
+{
+	if(pCache->m_pPrev[Index] != -1)
+		pCache->m_pNext[pCache->m_pPrev[Index]] = pCache->m_pNext[Index];
+	else if(pCache->m_First == Index)
+		pCache->m_First = pCache->m_pNext[Index];
+	else
+		return; // not linked
+
+	if(pCache->m_pNext[Index] != -1)
+		pCache->m_pPrev[pCache->m_pNext[Index]] = pCache->m_pPrev[Index];
+	else
+		pCache->m_Last = pCache->m_pPrev[Index];
+	pCache->m_pPrev[Index] = -1;
+	pCache->m_pNext[Index] = -1;
+}
+
+// only unpinned blocks are linked, so nothing evicted here can still be in use
+void _libtw07_datafile_cache_trim(libtw07_datafile *pDataFile)
+{
+	libtw07_datafileCache *pCache = pDataFile->m_pCache;
+	while(pCache->m_Stats.m_ResidentBytes > pCache->m_Stats.m_Budget && pCache->m_First != -1)
+	{
+		int Index = pCache->m_First;
+		_libtw07_datafile_cache_unlink(pCache, Index);
+
+		libtw07_print("datafile", "evicting data index=%d size=%d", Index, pDataFile->m_pDataSizes[Index]);
+		pCache->m_Stats.m_ResidentBytes -= _libtw07_datafile_reader_residentSize(pDataFile, Index);
+		pCache->m_Stats.m_Evictions++;
+		if(!(pDataFile->m_pDataFlags[Index]&LIBTW07_DATAFILE_DATAFLAG_BORROWED))
+			libtw07_allocator_free(&pDataFile->m_Allocator, pDataFile->m_ppDataPtrs[Index]);
+		pDataFile->m_ppDataPtrs[Index] = 0x0;
+		pDataFile->m_pDataSizes[Index] = 0;
+		pDataFile->m_pDataFlags[Index] = 0;
+		libtw07_atomic_store(&pDataFile->m_pDataStates[Index], LIBTW07_DATAFILE_DATASTATE_UNLOADED);
+	}
+}
+
+// takes a pin or makes the block sticky, a block without either goes to the back of the lru list
+void _libtw07_datafile_cache_take(libtw07_datafile *pDataFile, int Index, int Pin)
+{
+	libtw07_datafileCache *pCache = pDataFile->m_pCache;
+	_libtw07_datafile_cache_unlink(pCache, Index);
+	if(Pin)
+		pCache->m_pRefs[Index]++;
+	else
+		pDataFile->m_pDataFlags[Index] |= LIBTW07_DATAFILE_DATAFLAG_STICKY;
+}
+
+// ends the loading state of a block and wakes the threads waiting for it
+void _libtw07_datafile_reader_finishLoading(libtw07_datafile *pDataFile, int Index, int State)
+{
+	libtw07_lock_wait(&pDataFile->m_LoadLock);
+	libtw07_atomic_store(&pDataFile->m_pDataStates[Index], State);
+	libtw07_cond_broadcast(&pDataFile->m_LoadCond);
+	libtw07_lock_unlock(&pDataFile->m_LoadLock);
+}
+
+// sleeps while another thread loads the block
+void _libtw07_datafile_reader_waitLoading(libtw07_datafile *pDataFile, int Index)
+{
+	libtw07_lock_wait(&pDataFile->m_LoadLock);
+	while(libtw07_atomic_load(&pDataFile->m_pDataStates[Index]) == LIBTW07_DATAFILE_DATASTATE_LOADING)
+		libtw07_cond_wait(&pDataFile->m_LoadCond, &pDataFile->m_LoadLock);
+	libtw07_lock_unlock(&pDataFile->m_LoadLock);
+}
+
+// cache aware version of getDataImpl, loading happens outside of the cache lock
+void *_libtw07_datafile_reader_cacheAcquire(libtw07_datafileReader *pReader, int Index, int Swap, int Pin)
+{
+	libtw07_datafile *pDataFile = pReader->m_pDataFile;
+	libtw07_datafileCache *pCache = pDataFile->m_pCache;
+	volatile int *pState = &pDataFile->m_pDataStates[Index];
+
+	libtw07_lock_wait(&pCache->m_Lock);
+	while(1)
+	{
+		int State = libtw07_atomic_load(pState);
+		if(State == LIBTW07_DATAFILE_DATASTATE_LOADED)
+		{
+			_libtw07_datafile_cache_take(pDataFile, Index, Pin);
+			pCache->m_Stats.m_Hits++;
+			void *pData = pDataFile->m_ppDataPtrs[Index];
+			libtw07_lock_unlock(&pCache->m_Lock);
+			return pData;
+		}
+		if(State == LIBTW07_DATAFILE_DATASTATE_UNLOADED && libtw07_atomic_cas(pState, LIBTW07_DATAFILE_DATASTATE_UNLOADED, LIBTW07_DATAFILE_DATASTATE_LOADING))
+			break;
+
+		// another thread is loading the block
+		libtw07_lock_unlock(&pCache->m_Lock);
+		_libtw07_datafile_reader_waitLoading(pDataFile, Index);
+		libtw07_lock_wait(&pCache->m_Lock);
+	}
+	libtw07_lock_unlock(&pCache->m_Lock);
+
+	void *pData = _libtw07_datafile_reader_loadBlock(pReader, Index, Swap);
+
+	libtw07_lock_wait(&pCache->m_Lock);
+	pCache->m_Stats.m_Misses++;
+	if(pData)
+	{
+		pCache->m_Stats.m_ResidentBytes += _libtw07_datafile_reader_residentSize(pDataFile, Index);
+		_libtw07_datafile_cache_take(pDataFile, Index, Pin);
+		_libtw07_datafile_cache_trim(pDataFile);
+	}
+	_libtw07_datafile_reader_finishLoading(pDataFile, Index, pData ? LIBTW07_DATAFILE_DATASTATE_LOADED : LIBTW07_DATAFILE_DATASTATE_UNLOADED);
+	libtw07_lock_unlock(&pCache->m_Lock);
+	return pData;
+}
+
+// accounts a block that was loaded in bulk, it is unpinned and can be evicted right away
+void _libtw07_datafile_reader_cachePublish(libtw07_datafile *pDataFile, int Index)
+{
+	libtw07_datafileCache *pCache = pDataFile->m_pCache;
+	if(!pCache)
+	{
+		_libtw07_datafile_reader_finishLoading(pDataFile, Index, LIBTW07_DATAFILE_DATASTATE_LOADED);
+		return;
+	}
+
+	libtw07_lock_wait(&pCache->m_Lock);
+	pCache->m_Stats.m_Misses++;
+	pCache->m_Stats.m_ResidentBytes += _libtw07_datafile_reader_residentSize(pDataFile, Index);
+	_libtw07_datafile_cache_link(pCache, Index);
+	_libtw07_datafile_reader_finishLoading(pDataFile, Index, LIBTW07_DATAFILE_DATASTATE_LOADED);
+	_libtw07_datafile_cache_trim(pDataFile);
+	libtw07_lock_unlock(&pCache->m_Lock);
+}
+
+void *_libtw07_datafile_reader_getDataImpl(libtw07_datafileReader *pReader, int Index, int Swap)
+{
+	if(!pReader->m_pDataFile) { return 0; }
+
+	if(Index < 0 || Index >= pReader->m_pDataFile->m_Header.m_NumRawData)
+		return 0;
+
+	if(pReader->m_pDataFile->m_pCache)
+		return _libtw07_datafile_reader_cacheAcquire(pReader, Index, Swap, 0);
+
+	// load it if needed, only one thread does the loading
+	volatile int *pState = &pReader->m_pDataFile->m_pDataStates[Index];
+	while(1)
+	{
+		int State = libtw07_atomic_load(pState);
+		if(State == LIBTW07_DATAFILE_DATASTATE_LOADED)
+			return pReader->m_pDataFile->m_ppDataPtrs[Index];
+		if(State == LIBTW07_DATAFILE_DATASTATE_UNLOADED && libtw07_atomic_cas(pState, LIBTW07_DATAFILE_DATASTATE_UNLOADED, LIBTW07_DATAFILE_DATASTATE_LOADING))
+			break;
+		_libtw07_datafile_reader_waitLoading(pReader->m_pDataFile, Index);
+	}
+
+	void *pData = _libtw07_datafile_reader_loadBlock(pReader, Index, Swap);
+	_libtw07_datafile_reader_finishLoading(pReader->m_pDataFile, Index, pData ? LIBTW07_DATAFILE_DATASTATE_LOADED : LIBTW07_DATAFILE_DATASTATE_UNLOADED);
+	return pData;
+}
+
+void *libtw07_datafile_reader_getData(libtw07_datafileReader *pReader, int Index)
+{
+	return _libtw07_datafile_reader_getDataImpl(pReader, Index, 0);
+}
+
+void *libtw07_datafile_reader_getDataSwapped(libtw07_datafileReader *pReader, int Index)
+{
+	return _libtw07_datafile_reader_getDataImpl(pReader, Index, 1);
+}
+
+struct libtw07_datafileLoadTask
+{
+	libtw07_job m_Job;
+	int m_Index;
+	const void *m_pSrc;
+	int m_SrcSize;
+	void *m_pTemp;
+	char *m_pDst;
+	unsigned long m_DstSize;
+	const libtw07_allocator *m_pAllocator;
+};
+typedef struct libtw07_datafileLoadTask libtw07_datafileLoadTask;
+
+int _libtw07_datafile_reader_decompressJob(void *pData)
+{
+	libtw07_datafileLoadTask *pTask = (libtw07_datafileLoadTask *)pData;
+	return _libtw07_datafile_uncompress(pTask->m_pAllocator, pTask->m_pDst, &pTask->m_DstSize, pTask->m_pSrc, pTask->m_SrcSize);
+}
+
+// loads the given data blocks like getData does, reading happens on the calling thread while the
+// blocks are decompressed on the pool. without a pool the blocks are loaded one after another
+int libtw07_datafile_reader_loadData(libtw07_datafileReader *pReader, const int *pIndices, int Num, libtw07_jobPool *pPool)
+{
+	if(!pReader->m_pDataFile)
+		return -1;
+
+	if(!pPool || pReader->m_pDataFile->m_Header.m_Version != 4)
+	{
+		int Failed = 0;
+		for(int i = 0; i < Num; i++)
+		{
+			// out of range indices are skipped as on the pool path
+			if(pIndices[i] < 0 || pIndices[i] >= pReader->m_pDataFile->m_Header.m_NumRawData)
+				continue;
+			if(!libtw07_datafile_reader_getData(pReader, pIndices[i]))
+				Failed++;
+		}
+		return Failed ? -1 : 0;
+	}
+
+	libtw07_datafileLoadTask *pTasks = (libtw07_datafileLoadTask *) libtw07_allocator_alloc(&pReader->m_pDataFile->m_Allocator, Num * sizeof(libtw07_datafileLoadTask) + 1);
+	if(!pTasks)
+		return -1;
+
+	int NumTasks = 0;
+	int Failed = 0;
+	for(int i = 0; i < Num; i++)
+	{
+		int Index = pIndices[i];
+		if(Index < 0 || Index >= pReader->m_pDataFile->m_Header.m_NumRawData)
+			continue;
+
+		// skip blocks that are loaded, listed twice or being loaded by another thread
+		if(!libtw07_atomic_cas(&pReader->m_pDataFile->m_pDataStates[Index], LIBTW07_DATAFILE_DATASTATE_UNLOADED, LIBTW07_DATAFILE_DATASTATE_LOADING))
+			continue;
+
+		libtw07_datafileLoadTask *pTask = &pTasks[NumTasks];
+		pTask->m_Index = Index;
+		pTask->m_SrcSize = _libtw07_datafile_reader_getFileDataSize(pReader, Index);
+		pTask->m_DstSize = pReader->m_pDataFile->m_Info.m_pDataSizes[Index];
+		pTask->m_pSrc = 0;
+		pTask->m_pTemp = 0;
+		pTask->m_pDst = 0;
+		pTask->m_pAllocator = &pReader->m_pDataFile->m_Allocator;
+		if(pTask->m_SrcSize >= 0 && pReader->m_pDataFile->m_pMapped)
+			pTask->m_pSrc = _libtw07_datafile_reader_mapData(pReader->m_pDataFile, Index, pTask->m_SrcSize);
+		else if(pTask->m_SrcSize >= 0)
+		{
+			pTask->m_pTemp = libtw07_allocator_alloc(&pReader->m_pDataFile->m_Allocator, pTask->m_SrcSize + 1);
+			if(pTask->m_pTemp && _libtw07_datafile_reader_readData(pReader->m_pDataFile, Index, pTask->m_pTemp, pTask->m_SrcSize) == 0)
+				pTask->m_pSrc = pTask->m_pTemp;
+		}
+		if(pTask->m_pSrc && pReader->m_pDataFile->m_Info.m_pDataSizes[Index] >= 0)
+			pTask->m_pDst = (char *) libtw07_allocator_alloc(&pReader->m_pDataFile->m_Allocator, pTask->m_DstSize + 1);
+		if(!pTask->m_pDst)
+		{
+			libtw07_print("datafile", "could not load data index=%d", Index);
+			libtw07_allocator_free(&pReader->m_pDataFile->m_Allocator, pTask->m_pTemp);
+			_libtw07_datafile_reader_finishLoading(pReader->m_pDataFile, Index, LIBTW07_DATAFILE_DATASTATE_UNLOADED);
+			Failed++;
+			continue;
+		}
+
+		libtw07_print("datafile", "loading data index=%d size=%d uncompressed=%lu", Index, pTask->m_SrcSize, pTask->m_DstSize);
+		libtw07_jobpool_add(pPool, &pTask->m_Job, _libtw07_datafile_reader_decompressJob, pTask);
+		NumTasks++;
+	}
+
+	// publish the blocks in the same state getData leaves them in, failed ones go back to unloaded
+	for(int i = 0; i < NumTasks; i++)
+	{
+		libtw07_datafileLoadTask *pTask = &pTasks[i];
+		int Result = libtw07_jobpool_wait(pPool, &pTask->m_Job);
+		libtw07_allocator_free(&pReader->m_pDataFile->m_Allocator, pTask->m_pTemp);
+		if(Result != Z_OK)
+		{
+			libtw07_print("datafile", "could not decompress data index=%d, error %d", pTask->m_Index, Result);
+			libtw07_allocator_free(&pReader->m_pDataFile->m_Allocator, pTask->m_pDst);
+			_libtw07_datafile_reader_finishLoading(pReader->m_pDataFile, pTask->m_Index, LIBTW07_DATAFILE_DATASTATE_UNLOADED);
+			Failed++;
+			continue;
+		}
+		pReader->m_pDataFile->m_ppDataPtrs[pTask->m_Index] = pTask->m_pDst;
+		pReader->m_pDataFile->m_pDataSizes[pTask->m_Index] = pReader->m_pDataFile->m_Info.m_pDataSizes[pTask->m_Index];
+		_libtw07_datafile_reader_cachePublish(pReader->m_pDataFile, pTask->m_Index);
+	}
+
+	libtw07_allocator_free(&pReader->m_pDataFile->m_Allocator, pTasks);
+	return Failed ? -1 : 0;
+}
+
+int libtw07_datafile_reader_loadAll(libtw07_datafileReader *pReader, libtw07_jobPool *pPool)
+{
+	if(!pReader->m_pDataFile)
+		return -1;
+
+	int Num = pReader->m_pDataFile->m_Header.m_NumRawData;
+	int *pIndices = (int *) libtw07_allocator_alloc(&pReader->m_pDataFile->m_Allocator, Num * sizeof(int) + 1);
+	if(!pIndices)
+		return -1;
+	for(int i = 0; i < Num; i++)
+		pIndices[i] = i;
+
+	int Result = libtw07_datafile_reader_loadData(pReader, pIndices, Num, pPool);
+	libtw07_allocator_free(&pReader->m_pDataFile->m_Allocator, pIndices);
+	return Result;
+}
+
+// decompresses a data block into memory owned by the caller without any heap allocations, the
+// block is taken from the file even when it is loaded. returns the number of bytes written or -1
+int libtw07_datafile_reader_readDataInto(libtw07_datafileReader *pReader, int Index, void *pDst, int DstSize)
+{
+	if(!pReader->m_pDataFile || Index < 0 || Index >= pReader->m_pDataFile->m_Header.m_NumRawData)
+		return -1;
+
+	libtw07_datafile *pDataFile = pReader->m_pDataFile;
+	int DataSize = _libtw07_datafile_reader_getFileDataSize(pReader, Index);
+	int UncompressedSize = pDataFile->m_Header.m_Version == 4 ? pDataFile->m_Info.m_pDataSizes[Index] : DataSize;
+	if(DataSize < 0 || UncompressedSize > DstSize)
+	{
+		libtw07_print("datafile", "data index=%d does not fit, size=%d buffer=%d", Index, UncompressedSize, DstSize);
+		return -1;
+	}
+
+	unsigned char *pMapped = 0;
+	if(pDataFile->m_pMapped)
+	{
+		pMapped = _libtw07_datafile_reader_mapData(pDataFile, Index, DataSize);
+		if(!pMapped)
+			return -1;
+	}
+
+	if(pDataFile->m_Header.m_Version == 4)
+		return _libtw07_datafile_reader_inflateInto(pDataFile, Index, pMapped, DataSize, pDst, DstSize);
+
+	if(pMapped)
+		memcpy(pDst, pMapped, DataSize);
+	else if(_libtw07_datafile_reader_readData(pDataFile, Index, pDst, DataSize) != 0)
+		return -1;
+	return DataSize;
+}
+
+// waits for a block another thread is loading before freeing it, pinned blocks are kept. without a
+// cache nothing tracks who still uses the block, the caller has to make sure no thread does
+void libtw07_datafile_reader_unloadData(libtw07_datafileReader *pReader,int Index)
+{
+	if(!pReader->m_pDataFile || Index < 0 || Index >= pReader->m_pDataFile->m_Header.m_NumRawData)
+		return;
+
+	libtw07_datafile *pDataFile = pReader->m_pDataFile;
+	libtw07_datafileCache *pCache = pDataFile->m_pCache;
+	volatile int *pState = &pDataFile->m_pDataStates[Index];
+
+	// claiming the state keeps other threads from loading the block while it is freed
+	if(pCache)
+		libtw07_lock_wait(&pCache->m_Lock);
+	int State;
+	while(1)
+	{
+		if(pCache && pCache->m_pRefs[Index] > 0)
+		{
+			libtw07_print("datafile", "not unloading data index=%d, it is still pinned", Index);
+			libtw07_lock_unlock(&pCache->m_Lock);
+			return;
+		}
+
+		State = libtw07_atomic_load(pState);
+		if(State != LIBTW07_DATAFILE_DATASTATE_LOADING && libtw07_atomic_cas(pState, State, LIBTW07_DATAFILE_DATASTATE_LOADING))
+			break;
+
+		// another thread is loading the block
+		if(pCache)
+			libtw07_lock_unlock(&pCache->m_Lock);
+		_libtw07_datafile_reader_waitLoading(pDataFile, Index);
+		if(pCache)
+			libtw07_lock_wait(&pCache->m_Lock);
+	}
+
+	if(State == LIBTW07_DATAFILE_DATASTATE_LOADED)
+	{
+		if(pCache)
+		{
+			_libtw07_datafile_cache_unlink(pCache, Index);
+			pCache->m_Stats.m_ResidentBytes -= _libtw07_datafile_reader_residentSize(pDataFile, Index);
+		}
+		if(!(pDataFile->m_pDataFlags[Index]&LIBTW07_DATAFILE_DATAFLAG_BORROWED))
+			libtw07_allocator_free(&pDataFile->m_Allocator, pDataFile->m_ppDataPtrs[Index]);
+	}
+	pDataFile->m_ppDataPtrs[Index] = 0x0;
+	pDataFile->m_pDataSizes[Index] = 0;
+	pDataFile->m_pDataFlags[Index] = 0;
+	_libtw07_datafile_reader_finishLoading(pDataFile, Index, LIBTW07_DATAFILE_DATASTATE_UNLOADED);
+	if(pCache)
+		libtw07_lock_unlock(&pCache->m_Lock);
+}
+
+// allocates memory the reader takes over with replaceData
+void *libtw07_datafile_reader_allocData(libtw07_datafileReader *pReader, size_t Size)
+{
+	if(!pReader->m_pDataFile)
+		return 0;
+	return libtw07_allocator_alloc(&pReader->m_pDataFile->m_Allocator, Size);
+}
+
+// releases memory from libtw07_datafile_reader_allocData that was not given to replaceData
+void libtw07_datafile_reader_freeData(libtw07_datafileReader *pReader, void *pData)
+{
+	if(!pReader->m_pDataFile)
+		return;
+	libtw07_allocator_free(&pReader->m_pDataFile->m_Allocator, pData);
+}
+
+// the reader takes over pData on success, it has to come from libtw07_datafile_reader_allocData.
+// fails for pinned blocks, the caller keeps pData then
+int libtw07_datafile_reader_replaceData(libtw07_datafileReader *pReader, int Index, char *pData, int Size)
+{
+	if(!pReader->m_pDataFile || Index < 0 || Index >= pReader->m_pDataFile->m_Header.m_NumRawData)
+		return -1;
+
+	libtw07_datafile *pDataFile = pReader->m_pDataFile;
+	libtw07_datafileCache *pCache = pDataFile->m_pCache;
+	volatile int *pState = &pDataFile->m_pDataStates[Index];
+
+	// the pin check, the unload and the publish happen under one cache lock, so the block can not
+	// be pinned in between. claiming its state keeps other threads from loading it meanwhile
+	if(pCache)
+		libtw07_lock_wait(&pCache->m_Lock);
+	int State;
+	while(1)
+	{
+		// a pinned block can not be unloaded, replacing it would change the data under the pin
+		if(pCache && pCache->m_pRefs[Index] > 0)
+		{
+			libtw07_print("datafile", "not replacing data index=%d, it is still pinned", Index);
+			libtw07_lock_unlock(&pCache->m_Lock);
+			return -1;
+		}
+
+		State = libtw07_atomic_load(pState);
+		if(State != LIBTW07_DATAFILE_DATASTATE_LOADING && libtw07_atomic_cas(pState, State, LIBTW07_DATAFILE_DATASTATE_LOADING))
+			break;
+
+		// another thread is loading the block
+		if(pCache)
+			libtw07_lock_unlock(&pCache->m_Lock);
+		_libtw07_datafile_reader_waitLoading(pDataFile, Index);
+		if(pCache)
+			libtw07_lock_wait(&pCache->m_Lock);
+	}
+
+	if(State == LIBTW07_DATAFILE_DATASTATE_LOADED)
+	{
+		if(pCache)
+		{
+			_libtw07_datafile_cache_unlink(pCache, Index);
+			pCache->m_Stats.m_ResidentBytes -= _libtw07_datafile_reader_residentSize(pDataFile, Index);
+		}
+		if(!(pDataFile->m_pDataFlags[Index]&LIBTW07_DATAFILE_DATAFLAG_BORROWED))
+			libtw07_allocator_free(&pDataFile->m_Allocator, pDataFile->m_ppDataPtrs[Index]);
+	}
+
+	pDataFile->m_ppDataPtrs[Index] = pData;
+	pDataFile->m_pDataSizes[Index] = Size;
+	pDataFile->m_pDataFlags[Index] = LIBTW07_DATAFILE_DATAFLAG_REPLACED;
+	if(pCache)
+	{
+		pDataFile->m_pDataFlags[Index] |= LIBTW07_DATAFILE_DATAFLAG_STICKY;
+		pCache->m_Stats.m_ResidentBytes += Size;
+	}
+	_libtw07_datafile_reader_finishLoading(pDataFile, Index, LIBTW07_DATAFILE_DATASTATE_LOADED);
+	if(pCache)
+	{
+		_libtw07_datafile_cache_trim(pDataFile);
+		libtw07_lock_unlock(&pCache->m_Lock);
+	}
+	return 0;
+}
+
+// whether the block currently holds data given to replaceData instead of what the file stores
+int libtw07_datafile_reader_isDataReplaced(libtw07_datafileReader *pReader, int Index)
+{
+	if(!pReader->m_pDataFile || Index < 0 || Index >= pReader->m_pDataFile->m_Header.m_NumRawData)
+		return 0;
+	if(libtw07_atomic_load(&pReader->m_pDataFile->m_pDataStates[Index]) != LIBTW07_DATAFILE_DATASTATE_LOADED)
+		return 0;
+	return (pReader->m_pDataFile->m_pDataFlags[Index]&LIBTW07_DATAFILE_DATAFLAG_REPLACED) != 0;
+}
+
+// limits the memory used by loaded data blocks of an open reader. blocks handed out by getData
+// stay loaded until they are unloaded, use pinData and unpinData for blocks the cache may evict.
+// fails when the datafile lives in an arena, evicting would not free anything there
+int libtw07_datafile_reader_setCacheBudget(libtw07_datafileReader *pReader, int64_t Budget)
+{
+	if(!pReader->m_pDataFile)
+		return -1;
+	if(pReader->m_pDataFile->m_pArena)
+	{
+		libtw07_print("datafile", "a cache budget does not work together with an arena");
+		return -1;
+	}
+
+	libtw07_datafile *pDataFile = pReader->m_pDataFile;
+	if(pDataFile->m_pCache)
+	{
+		libtw07_lock_wait(&pDataFile->m_pCache->m_Lock);
+		pDataFile->m_pCache->m_Stats.m_Budget = Budget;
+		_libtw07_datafile_cache_trim(pDataFile);
+		libtw07_lock_unlock(&pDataFile->m_pCache->m_Lock);
+		return 0;
+	}
+
+	int Num = pDataFile->m_Header.m_NumRawData;
+	libtw07_datafileCache *pCache = (libtw07_datafileCache *) libtw07_allocator_alloc(&pDataFile->m_Allocator, sizeof(libtw07_datafileCache) + 3 * Num * sizeof(int));
+	if(!pCache)
+		return -1;
+
+	libtw07_lock_init(&pCache->m_Lock);
+	memset(&pCache->m_Stats, 0, sizeof(pCache->m_Stats));
+	pCache->m_Stats.m_Budget = Budget;
+	pCache->m_pRefs = (int *)(pCache+1);
+	pCache->m_pPrev = pCache->m_pRefs + Num;
+	pCache->m_pNext = pCache->m_pPrev + Num;
+	pCache->m_First = -1;
+	pCache->m_Last = -1;
+	memset(pCache->m_pRefs, 0, Num * sizeof(int));
+	memset(pCache->m_pPrev, 0xff, 2 * Num * sizeof(int));
+
+	// whatever is loaded already may be referenced by the caller
+	for(int i = 0; i < Num; i++)
+	{
+		if(libtw07_atomic_load(&pDataFile->m_pDataStates[i]) == LIBTW07_DATAFILE_DATASTATE_LOADED)
+		{
+			pDataFile->m_pDataFlags[i] |= LIBTW07_DATAFILE_DATAFLAG_STICKY;
+			pCache->m_Stats.m_ResidentBytes += _libtw07_datafile_reader_residentSize(pDataFile, i);
+		}
+	}
+
+	pDataFile->m_pCache = pCache;
+	return 0;
+}
+
+// returns the data block and keeps it loaded until the matching unpinData
+void *libtw07_datafile_reader_pinData(libtw07_datafileReader *pReader, int Index)
+{
+	if(!pReader->m_pDataFile || Index < 0 || Index >= pReader->m_pDataFile->m_Header.m_NumRawData)
+		return 0;
+	if(!pReader->m_pDataFile->m_pCache)
+		return _libtw07_datafile_reader_getDataImpl(pReader, Index, 0);
+	return _libtw07_datafile_reader_cacheAcquire(pReader, Index, 0, 1);
+}
+
+void libtw07_datafile_reader_unpinData(libtw07_datafileReader *pReader, int Index)
+{
+	if(!pReader->m_pDataFile || !pReader->m_pDataFile->m_pCache || Index < 0 || Index >= pReader->m_pDataFile->m_Header.m_NumRawData)
+		return;
+
+	libtw07_datafileCache *pCache = pReader->m_pDataFile->m_pCache;
+	libtw07_lock_wait(&pCache->m_Lock);
+	libtw07_dbg_assert(pCache->m_pRefs[Index] > 0, "unpinning data that is not pinned");
+	if(--pCache->m_pRefs[Index] == 0 && !(pReader->m_pDataFile->m_pDataFlags[Index]&LIBTW07_DATAFILE_DATAFLAG_STICKY))
+	{
+		_libtw07_datafile_cache_link(pCache, Index);
+		_libtw07_datafile_cache_trim(pReader->m_pDataFile);
+	}
+	libtw07_lock_unlock(&pCache->m_Lock);
+}
+
+void libtw07_datafile_reader_getCacheStats(libtw07_datafileReader *pReader, libtw07_datafileCacheStats *pStats)
+{
+	memset(pStats, 0, sizeof(*pStats));
+	if(!pReader->m_pDataFile || !pReader->m_pDataFile->m_pCache)
+		return;
+
+	libtw07_lock_wait(&pReader->m_pDataFile->m_pCache->m_Lock);
+	*pStats = pReader->m_pDataFile->m_pCache->m_Stats;
+	libtw07_lock_unlock(&pReader->m_pDataFile->m_pCache->m_Lock);
+}
+
+int _libtw07_datafile_reader_getFileItemSize(libtw07_datafileReader *pReader, int Index)
+{
+	if(!pReader->m_pDataFile) { return 0; }
+	if(Index == pReader->m_pDataFile->m_Header.m_NumItems-1)
+		return pReader->m_pDataFile->m_Header.m_ItemSize - pReader->m_pDataFile->m_Info.m_pItemOffsets[Index];
+	return pReader->m_pDataFile->m_Info.m_pItemOffsets[Index+1] - pReader->m_pDataFile->m_Info.m_pItemOffsets[Index];
+}
+
+int libtw07_datafile_reader_getItemSize(libtw07_datafileReader *pReader, int Index)
+{
+	int FileSize = _libtw07_datafile_reader_getFileItemSize(pReader, Index);
+	if(FileSize == 0)
+	{
+		return 0;
+	}
+	return FileSize - sizeof(libtw07_datafileItem);
+}
+
+void *libtw07_datafile_reader_getItem(libtw07_datafileReader *pReader, int Index, int *pType, int *pID)
+{
+	if(!pReader->m_pDataFile || Index < 0 || Index >= pReader->m_pDataFile->m_Header.m_NumItems)
+	{
+		if(pType)
+			*pType = 0;
+		if(pID)
+			*pID = 0;
+
+		return 0;
+	}
+
+	libtw07_datafileItem *i = (libtw07_datafileItem *) (pReader->m_pDataFile->m_Info.m_pItemStart + pReader->m_pDataFile->m_Info.m_pItemOffsets[Index]);
+	if(pType)
+		*pType = (i->m_TypeAndID>>16)&0xffff; // remove sign extention
+	if(pID)
+		*pID = i->m_TypeAndID&0xffff;
+	return (void *)(i+1);
+}
+
+void libtw07_datafile_reader_getType(libtw07_datafileReader *pReader, int Type, int *pStart, int *pNum)
+{
+	*pStart = 0;
+	*pNum = 0;
+
+	if(!pReader->m_pDataFile)
+		return;
+
+	if(pReader->m_pDataFile->m_pIndex)
+	{
+		int Index = _libtw07_datafile_reader_findType(pReader->m_pDataFile, Type);
+		if(Index == -1)
+			return;
+		*pStart = pReader->m_pDataFile->m_Info.m_pItemTypes[Index].m_Start;
+		*pNum = pReader->m_pDataFile->m_Info.m_pItemTypes[Index].m_Num;
+		return;
+	}
+
+	for(int i = 0; i < pReader->m_pDataFile->m_Header.m_NumItemTypes; i++)
+	{
+		if(pReader->m_pDataFile->m_Info.m_pItemTypes[i].m_Type == Type)
+		{
+			*pStart = pReader->m_pDataFile->m_Info.m_pItemTypes[i].m_Start;
+			*pNum = pReader->m_pDataFile->m_Info.m_pItemTypes[i].m_Num;
+			return;
+		}
+	}
+}
+
+int libtw07_datafile_reader_findItemIndex(libtw07_datafileReader *pReader, int Type, int ID)
+{
+	if(!pReader->m_pDataFile) return -1;
+
+	if(pReader->m_pDataFile->m_pIndex)
+	{
+		if(!pReader->m_pDataFile->m_pItemHash || Type < 0 || Type > 0xffff || ID < 0 || ID > 0xffff)
+			return -1;
+
+		uint32_t Key = ((uint32_t)Type << 16) | (uint32_t)ID;
+		return _libtw07_datafile_hashSlot(pReader->m_pDataFile->m_pItemHash, pReader->m_pDataFile->m_ItemHashMask, Key)->m_Item - 1;
+	}
+
+	int Start, Num;
+	libtw07_datafile_reader_getType(pReader, Type, &Start, &Num);
+	for(int i = 0; i < Num; i++)
 	{
 		int ItemID;
-		void *pItem = libtw07_datafile_reader_getItem(pReader, Start+i,0, &ItemID);
+		libtw07_datafile_reader_getItem(pReader, Start+i, 0, &ItemID);
 		if(ID == ItemID)
-			return pItem;
+			return Start+i;
+	}
+	return -1;
+}
+
+void *libtw07_datafile_reader_findItem(libtw07_datafileReader *pReader, int Type, int ID)
+{
+	int Index = libtw07_datafile_reader_findItemIndex(pReader, Type, ID);
+	if(Index < 0)
+		return 0;
+	return libtw07_datafile_reader_getItem(pReader, Index, 0, 0);
+}
+
+int libtw07_datafile_reader_numItemTypes(libtw07_datafileReader *pReader)
+{
+	if(!pReader->m_pDataFile) return 0;
+	return pReader->m_pDataFile->m_Header.m_NumItemTypes;
+}
+
+// iterates the item types in file order, use with getItem to walk the items of each type
+int libtw07_datafile_reader_getItemType(libtw07_datafileReader *pReader, int Index, int *pType, int *pStart, int *pNum)
+{
+	if(!pReader->m_pDataFile || Index < 0 || Index >= pReader->m_pDataFile->m_Header.m_NumItemTypes)
+	{
+		if(pType)
+			*pType = 0;
+		if(pStart)
+			*pStart = 0;
+		if(pNum)
+			*pNum = 0;
+		return -1;
 	}
+
+	if(pType)
+		*pType = pReader->m_pDataFile->m_Info.m_pItemTypes[Index].m_Type;
+	if(pStart)
+		*pStart = pReader->m_pDataFile->m_Info.m_pItemTypes[Index].m_Start;
+	if(pNum)
+		*pNum = pReader->m_pDataFile->m_Info.m_pItemTypes[Index].m_Num;
 	return 0;
 }
 
@@ -488,25 +1872,52 @@ int libtw07_datafile_reader_close(libtw07_datafileReader *pReader)
 	int i;
 	for(i = 0; i < pReader->m_pDataFile->m_Header.m_NumRawData; i++)
 	{
-		free(pReader->m_pDataFile->m_ppDataPtrs[i]);
+		if(!(pReader->m_pDataFile->m_pDataFlags[i]&LIBTW07_DATAFILE_DATAFLAG_BORROWED))
+			libtw07_allocator_free(&pReader->m_pDataFile->m_Allocator, pReader->m_pDataFile->m_ppDataPtrs[i]);
 		pReader->m_pDataFile->m_pDataSizes[i] = 0;
 	}
 
-	fclose(pReader->m_pDataFile->m_File);
-	free(pReader->m_pDataFile);
+	if(pReader->m_pDataFile->m_File)
+		fclose(pReader->m_pDataFile->m_File);
+#if defined(LIBTW07_DATAFILE_POSIX)
+	if(pReader->m_pDataFile->m_Mapping == LIBTW07_DATAFILE_MAPPING_MMAP)
+		munmap(pReader->m_pDataFile->m_pMapped, pReader->m_pDataFile->m_MappedSize);
+#endif
+	if(pReader->m_pDataFile->m_Mapping == LIBTW07_DATAFILE_MAPPING_OWNED)
+		free(pReader->m_pDataFile->m_pMapped);
+	libtw07_allocator_free(&pReader->m_pDataFile->m_Allocator, pReader->m_pDataFile->m_pIndex);
+	if(pReader->m_pDataFile->m_pCache)
+	{
+		libtw07_lock_destroy(&pReader->m_pDataFile->m_pCache->m_Lock);
+		libtw07_allocator_free(&pReader->m_pDataFile->m_Allocator, pReader->m_pDataFile->m_pCache);
+	}
+	_libtw07_datafile_reader_freeDataFile(pReader->m_pDataFile);
 	pReader->m_pDataFile = 0;
 	return 0;
 }
 
+int _libtw07_datafile_reader_ensureHashed(libtw07_datafileReader *pReader)
+{
+	if(!pReader->m_pDataFile) return 0;
+	if(!libtw07_atomic_load(&pReader->m_pDataFile->m_Hashed) && (pReader->m_pDataFile->m_Flags&LIBTW07_DATAFILE_OPENFLAG_HASH_LAZY))
+	{
+		libtw07_lock_wait(&pReader->m_pDataFile->m_HashLock);
+		if(!libtw07_atomic_load(&pReader->m_pDataFile->m_Hashed))
+			_libtw07_datafile_reader_hashFile(pReader->m_pDataFile);
+		libtw07_lock_unlock(&pReader->m_pDataFile->m_HashLock);
+	}
+	return libtw07_atomic_load(&pReader->m_pDataFile->m_Hashed);
+}
+
 SHA256_DIGEST libtw07_datafile_reader_sha256(libtw07_datafileReader *pReader)
 {
-	if(!pReader->m_pDataFile) return SHA256_ZEROED;
+	if(!_libtw07_datafile_reader_ensureHashed(pReader)) return SHA256_ZEROED;
 	return pReader->m_pDataFile->m_Sha256;
 }
 
 uint32_t libtw07_datafile_reader_crc(libtw07_datafileReader *pReader)
 {
-	if(!pReader->m_pDataFile) return 0xFFFFFFFF;
+	if(!_libtw07_datafile_reader_ensureHashed(pReader)) return 0xFFFFFFFF;
 	return pReader->m_pDataFile->m_Crc;
 }
 
@@ -519,166 +1930,763 @@ int libtw07_datafile_reader_checkSha256(FILE *File, const void *pSha256)
 	
 	while(1)
 	{
-		unsigned Bytes = fread(aBuffer, 1, sizeof(aBuffer), File);
-		if(Bytes == 0)
-			break;
-		sha256_update(&Sha256Ctx, aBuffer, Bytes);
+		unsigned Bytes = fread(aBuffer, 1, sizeof(aBuffer), File);
+		if(Bytes == 0)
+			break;
+		sha256_update(&Sha256Ctx, aBuffer, Bytes);
+	}
+
+	fseek(File, 0, SEEK_SET);
+	SHA256_DIGEST Sha256 = sha256_finish(&Sha256Ctx);
+
+	return !sha256_comp(*(const SHA256_DIGEST *)pSha256, Sha256);
+}
+
+// a block that is compressed on the job pool, it stays in place while the job runs
+struct libtw07_datafileWriter_compressTask
+{
+	libtw07_job m_Job;
+	const void *m_pSrc;
+	int m_SrcSize;
+	int m_FreeSrc;
+	void *m_pDst;
+	int m_DstSize;
+	int m_Level;
+	int m_Strategy;
+};
+typedef struct libtw07_datafileWriter_compressTask libtw07_datafileWriter_compressTask;
+
+struct libtw07_datafileWriter_dataInfo
+{
+	int m_UncompressedSize;
+	int m_CompressedSize;
+	void *m_pCompressedData;
+	libtw07_datafileWriter_compressTask *m_pTask; // set until the compressed data is collected
+	int64_t m_SpillOffset; // where the block sits in the spill file, -1 while it is in memory
+	SHA256_DIGEST m_Hash; // of the uncompressed data, only set for blocks added with dedup enabled
+};
+typedef struct libtw07_datafileWriter_dataInfo libtw07_datafileWriter_dataInfo;
+
+struct libtw07_datafileWriter_itemInfo
+{
+	int m_Type;
+	int m_ID;
+	int m_Size;
+	int m_Next;
+	int m_Prev;
+	void *m_pData;
+	int m_Owned; // m_pData is freed by the writer
+};
+typedef struct libtw07_datafileWriter_itemInfo libtw07_datafileWriter_itemInfo;
+
+struct libtw07_datafileWriter_itemTypeInfo
+{
+	int m_Type;
+	int m_Num;
+	int m_First;
+	int m_Last;
+};
+typedef struct libtw07_datafileWriter_itemTypeInfo libtw07_datafileWriter_itemTypeInfo;
+
+struct libtw07_datafileDedupStats
+{
+	int m_NumDuplicates; // blocks that were given the index of an earlier one
+	int64_t m_BytesSaved; // uncompressed bytes that were neither compressed nor stored
+};
+typedef struct libtw07_datafileDedupStats libtw07_datafileDedupStats;
+
+// gets the file in pieces and in order, returns 0 when they were written
+typedef int (*LIBTW07_DATAFILE_WRITEFUNC)(void *pUser, const void *pData, int Size);
+
+struct libtw07_datafileWriter
+{
+	int m_Sink;
+	FILE *m_File;
+	LIBTW07_DATAFILE_WRITEFUNC m_pfnWrite;
+	void *m_pWriteUser;
+	char *m_pMemory; // the finished file when writing to memory
+	int m_MemorySize;
+	FILE *m_SpillFile; // compressed blocks that are already out of memory
+	int64_t m_SpillSize;
+	int m_NumSpilled; // every block below this index is in the spill file
+	int m_SpillFailed;
+	int m_NumItems;
+	int m_NumDatas;
+	int m_NumItemTypes;
+	int m_ItemsCapacity;
+	int m_DatasCapacity;
+	int m_ItemTypesCapacity;
+	libtw07_datafileWriter_itemTypeInfo *m_pItemTypes; // only the used types, sorted by type
+	libtw07_datafileWriter_itemInfo *m_pItems;
+	libtw07_datafileWriter_dataInfo *m_pDatas;
+	libtw07_jobPool *m_pPool;
+	int m_Level;
+	int m_Strategy;
+
+	// identical blocks share one data index
+	int m_Dedup;
+	uint32_t m_DedupMask;
+	int *m_pDedupTable; // hash -> data index or -1
+	int m_NumDeduped; // blocks in m_pDedupTable
+	libtw07_datafileDedupStats m_DedupStats;
+
+	// hashes of the output, taken while finish writes it
+	SHA256_CTX m_Sha256Ctx;
+	SHA256_DIGEST m_Sha256;
+	uint32_t m_Crc;
+	int m_Hashed;
+};
+typedef struct libtw07_datafileWriter libtw07_datafileWriter;
+
+enum
+{
+	LIBTW07_DATAFILE_WRITER_MIN_CAPACITY=64,
+	LIBTW07_DATAFILE_WRITER_SPILL_QUEUE=16, // blocks that may wait for the job pool while spilling
+
+	// where the writer puts the file
+	LIBTW07_DATAFILE_SINK_NONE=0,
+	LIBTW07_DATAFILE_SINK_FILE,
+	LIBTW07_DATAFILE_SINK_MEMORY,
+	LIBTW07_DATAFILE_SINK_CALLBACK,
+
+	// what the writer does with buffers passed to addItemEx and addDataEx
+	LIBTW07_DATAFILE_BUFFER_COPY=0, // copied when needed, the caller keeps the buffer
+	LIBTW07_DATAFILE_BUFFER_BORROW, // used in place, it has to stay valid until finish
+	LIBTW07_DATAFILE_BUFFER_TAKE, // used in place and freed with free() by the writer, only when the add succeeds
+
+	// compression levels, everything from 0 to 9 works. the format needs zlib streams for all
+	// blocks, store still wraps the data in one but skips the deflate work
+	LIBTW07_DATAFILE_COMPRESSION_DEFAULT=MZ_DEFAULT_COMPRESSION,
+	LIBTW07_DATAFILE_COMPRESSION_STORE=MZ_NO_COMPRESSION,
+	LIBTW07_DATAFILE_COMPRESSION_FAST=MZ_BEST_SPEED,
+	LIBTW07_DATAFILE_COMPRESSION_BEST=MZ_BEST_COMPRESSION,
+
+	LIBTW07_DATAFILE_STRATEGY_DEFAULT=MZ_DEFAULT_STRATEGY,
+	LIBTW07_DATAFILE_STRATEGY_FILTERED=MZ_FILTERED,
+	LIBTW07_DATAFILE_STRATEGY_HUFFMAN_ONLY=MZ_HUFFMAN_ONLY,
+	LIBTW07_DATAFILE_STRATEGY_RLE=MZ_RLE, // good for tile layers
+	LIBTW07_DATAFILE_STRATEGY_FIXED=MZ_FIXED,
+};
+
+void libtw07_datafile_writer_init(libtw07_datafileWriter *pWriter)
+{
+	pWriter->m_Sink = LIBTW07_DATAFILE_SINK_NONE;
+	pWriter->m_File = 0;
+	pWriter->m_pfnWrite = 0;
+	pWriter->m_pWriteUser = 0;
+	pWriter->m_pMemory = 0;
+	pWriter->m_MemorySize = 0;
+	pWriter->m_SpillFile = 0;
+	pWriter->m_SpillSize = 0;
+	pWriter->m_NumSpilled = 0;
+	pWriter->m_SpillFailed = 0;
+	pWriter->m_NumItems = 0;
+	pWriter->m_NumDatas = 0;
+	pWriter->m_NumItemTypes = 0;
+	pWriter->m_ItemsCapacity = 0;
+	pWriter->m_DatasCapacity = 0;
+	pWriter->m_ItemTypesCapacity = 0;
+	pWriter->m_pItemTypes = 0;
+	pWriter->m_pItems = 0;
+	pWriter->m_pDatas = 0;
+	pWriter->m_pPool = 0;
+	pWriter->m_Level = LIBTW07_DATAFILE_COMPRESSION_DEFAULT;
+	pWriter->m_Strategy = LIBTW07_DATAFILE_STRATEGY_DEFAULT;
+	pWriter->m_Dedup = 0;
+	pWriter->m_DedupMask = 0;
+	pWriter->m_pDedupTable = 0;
+	pWriter->m_NumDeduped = 0;
+	pWriter->m_DedupStats.m_NumDuplicates = 0;
+	pWriter->m_DedupStats.m_BytesSaved = 0;
+	pWriter->m_Sha256 = SHA256_ZEROED;
+	pWriter->m_Crc = 0;
+	pWriter->m_Hashed = 0;
+}
+
+// sets the compression used by addData, addDataEx picks it per block
+void libtw07_datafile_writer_setCompression(libtw07_datafileWriter *pWriter, int Level, int Strategy)
+{
+	pWriter->m_Level = Level;
+	pWriter->m_Strategy = Strategy;
+}
+
+// with a pool addData only queues the block, it is compressed on the pool while more is added
+// and finish writes the results in order. the pool has to outlive the writer's use of it
+void libtw07_datafile_writer_setJobPool(libtw07_datafileWriter *pWriter, libtw07_jobPool *pPool)
+{
+	pWriter->m_pPool = pPool;
+}
+
+// with dedup addData hashes every block and returns the index of an earlier identical block
+// instead of compressing it again. blocks added while it is off are never matched
+void libtw07_datafile_writer_setDedup(libtw07_datafileWriter *pWriter, int Enable)
+{
+	pWriter->m_Dedup = Enable;
+}
+
+void libtw07_datafile_writer_getDedupStats(libtw07_datafileWriter *pWriter, libtw07_datafileDedupStats *pStats)
+{
+	*pStats = pWriter->m_DedupStats;
+}
+
+uint32_t _libtw07_datafile_writer_dedupKey(const SHA256_DIGEST *pHash)
+{
+	return (uint32_t)pHash->data[0] | ((uint32_t)pHash->data[1] << 8) | ((uint32_t)pHash->data[2] << 16) | ((uint32_t)pHash->data[3] << 24);
+}
+
+// returns the slot of the block with this hash and size or the empty slot where it belongs
+int *_libtw07_datafile_writer_dedupSlot(libtw07_datafileWriter *pWriter, const SHA256_DIGEST *pHash, int Size)
+{
+	uint32_t Slot = _libtw07_datafile_writer_dedupKey(pHash) & pWriter->m_DedupMask;
+	while(pWriter->m_pDedupTable[Slot] != -1)
+	{
+		libtw07_datafileWriter_dataInfo *pInfo = &pWriter->m_pDatas[pWriter->m_pDedupTable[Slot]];
+		if(pInfo->m_UncompressedSize == Size && sha256_comp(pInfo->m_Hash, *pHash) == 0)
+			break;
+		Slot = (Slot + 1) & pWriter->m_DedupMask;
+	}
+	return &pWriter->m_pDedupTable[Slot];
+}
+
+// keeps the table at most half full
+int _libtw07_datafile_writer_dedupGrow(libtw07_datafileWriter *pWriter)
+{
+	uint32_t Size = pWriter->m_DedupMask + 1;
+	if(pWriter->m_pDedupTable && (uint32_t)(pWriter->m_NumDeduped + 1) * 2 <= Size)
+		return 0;
+
+	uint32_t NewSize = pWriter->m_pDedupTable ? Size * 2 : (uint32_t)LIBTW07_DATAFILE_WRITER_MIN_CAPACITY;
+	int *pNewTable = (int *) malloc(NewSize * sizeof(int));
+	if(!pNewTable)
+		return -1;
+	memset(pNewTable, 0xff, NewSize * sizeof(int));
+
+	int *pOldTable = pWriter->m_pDedupTable;
+	pWriter->m_pDedupTable = pNewTable;
+	pWriter->m_DedupMask = NewSize - 1;
+	if(pOldTable)
+	{
+		for(uint32_t i = 0; i < Size; i++)
+		{
+			if(pOldTable[i] == -1)
+				continue;
+			libtw07_datafileWriter_dataInfo *pInfo = &pWriter->m_pDatas[pOldTable[i]];
+			*_libtw07_datafile_writer_dedupSlot(pWriter, &pInfo->m_Hash, pInfo->m_UncompressedSize) = pOldTable[i];
+		}
+		free(pOldTable);
+	}
+	return 0;
+}
+
+// same as compress2, but with a strategy. the defaults give the exact output of compress
+int _libtw07_datafile_deflate(void *pDst, uLong *pDstSize, const void *pSrc, int SrcSize, int Level, int Strategy)
+{
+	mz_stream Stream;
+	memset(&Stream, 0, sizeof(Stream));
+	Stream.next_in = (const unsigned char *)pSrc;
+	Stream.avail_in = SrcSize;
+	Stream.next_out = (unsigned char *)pDst;
+	Stream.avail_out = (unsigned int)*pDstSize;
+
+	int Result = mz_deflateInit2(&Stream, Level, MZ_DEFLATED, MZ_DEFAULT_WINDOW_BITS, 9, Strategy);
+	if(Result != MZ_OK)
+		return Result;
+
+	Result = mz_deflate(&Stream, MZ_FINISH);
+	*pDstSize = Stream.total_out;
+	mz_deflateEnd(&Stream);
+	if(Result == MZ_STREAM_END)
+		return MZ_OK;
+	return Result == MZ_OK ? MZ_BUF_ERROR : Result;
+}
+
+// compresses into a buffer that is shrunk to the compressed size afterwards, returns a zlib status
+int _libtw07_datafile_writer_compress(const void *pSrc, int SrcSize, int Level, int Strategy, void **ppDst, int *pDstSize)
+{
+	uLong s = compressBound(SrcSize);
+	void *pCompData = malloc(s);
+	if(!pCompData)
+		return Z_MEM_ERROR;
+
+	int Result = _libtw07_datafile_deflate(pCompData, &s, pSrc, SrcSize, Level, Strategy);
+	if(Result != Z_OK)
+	{
+		free(pCompData);
+		return Result;
+	}
+
+	// shrinking keeps the block in place with most allocators
+	void *pShrunk = realloc(pCompData, s ? s : 1);
+	*ppDst = pShrunk ? pShrunk : pCompData;
+	*pDstSize = (int)s;
+	return Z_OK;
+}
+
+int _libtw07_datafile_writer_compressJob(void *pData)
+{
+	libtw07_datafileWriter_compressTask *pTask = (libtw07_datafileWriter_compressTask *)pData;
+	return _libtw07_datafile_writer_compress(pTask->m_pSrc, pTask->m_SrcSize, pTask->m_Level, pTask->m_Strategy, &pTask->m_pDst, &pTask->m_DstSize);
+}
+
+// waits for the queued blocks and takes over their compressed data
+void _libtw07_datafile_writer_collectData(libtw07_datafileWriter_dataInfo *pInfo)
+{
+	libtw07_datafileWriter_compressTask *pTask = pInfo->m_pTask;
+	if(!pTask)
+		return;
+
+	int Result = libtw07_jobpool_wait(pTask->m_Job.m_pPool, &pTask->m_Job);
+	if(Result != Z_OK)
+	{
+		libtw07_print("datafile", "compression error %d", Result);
+		libtw07_dbg_assert(0, "zlib error");
+	}
+	pInfo->m_CompressedSize = pTask->m_DstSize;
+	pInfo->m_pCompressedData = pTask->m_pDst;
+	pInfo->m_pTask = 0;
+	if(pTask->m_FreeSrc)
+		free((void *)pTask->m_pSrc);
+	free(pTask);
+}
+
+void _libtw07_datafile_writer_collect(libtw07_datafileWriter *pWriter)
+{
+	for(int i = 0; i < pWriter->m_NumDatas; i++)
+		_libtw07_datafile_writer_collectData(&pWriter->m_pDatas[i]);
+}
+
+// appends a block to the spill file, waits for it when it is still being compressed
+void _libtw07_datafile_writer_spillData(libtw07_datafileWriter *pWriter, libtw07_datafileWriter_dataInfo *pInfo)
+{
+	_libtw07_datafile_writer_collectData(pInfo);
+
+	if(fwrite(pInfo->m_pCompressedData, 1, pInfo->m_CompressedSize, pWriter->m_SpillFile) != (size_t)pInfo->m_CompressedSize)
+		pWriter->m_SpillFailed = 1;
+	free(pInfo->m_pCompressedData);
+	pInfo->m_pCompressedData = 0;
+	pInfo->m_SpillOffset = pWriter->m_SpillSize;
+	pWriter->m_SpillSize += pInfo->m_CompressedSize;
+}
+
+// moves every compressed block to the spill file as soon as it is done, so a slow block does not
+// keep the ones after it in memory. when more than LIBTW07_DATAFILE_WRITER_SPILL_QUEUE blocks are
+// still queued, it waits for the oldest ones
+void _libtw07_datafile_writer_spill(libtw07_datafileWriter *pWriter)
+{
+	int NumQueued = 0;
+	for(int i = pWriter->m_NumSpilled; i < pWriter->m_NumDatas; i++)
+	{
+		libtw07_datafileWriter_dataInfo *pInfo = &pWriter->m_pDatas[i];
+		if(pInfo->m_SpillOffset >= 0)
+			continue;
+		if(pInfo->m_pTask && libtw07_job_status(&pInfo->m_pTask->m_Job) != LIBTW07_JOB_STATE_DONE)
+			NumQueued++;
+		else
+			_libtw07_datafile_writer_spillData(pWriter, pInfo);
 	}
 
-	fseek(File, 0, SEEK_SET);
-	SHA256_DIGEST Sha256 = sha256_finish(&Sha256Ctx);
+	for(int i = pWriter->m_NumSpilled; i < pWriter->m_NumDatas && NumQueued > LIBTW07_DATAFILE_WRITER_SPILL_QUEUE; i++)
+	{
+		libtw07_datafileWriter_dataInfo *pInfo = &pWriter->m_pDatas[i];
+		if(pInfo->m_SpillOffset >= 0)
+			continue;
+		_libtw07_datafile_writer_spillData(pWriter, pInfo);
+		NumQueued--;
+	}
 
-	return !sha256_comp(*(const SHA256_DIGEST *)pSha256, Sha256);
+	while(pWriter->m_NumSpilled < pWriter->m_NumDatas && pWriter->m_pDatas[pWriter->m_NumSpilled].m_SpillOffset >= 0)
+		pWriter->m_NumSpilled++;
 }
 
-struct libtw07_datafileWriter_dataInfo
+void _libtw07_datafile_writer_closeSpill(libtw07_datafileWriter *pWriter)
 {
-	int m_UncompressedSize;
-	int m_CompressedSize;
-	void *m_pCompressedData;
-};
-typedef struct libtw07_datafileWriter_dataInfo libtw07_datafileWriter_dataInfo;
+	if(pWriter->m_SpillFile)
+		fclose(pWriter->m_SpillFile);
+	pWriter->m_SpillFile = 0;
+	pWriter->m_SpillSize = 0;
+	pWriter->m_NumSpilled = 0;
+	pWriter->m_SpillFailed = 0;
+}
 
-struct libtw07_datafileWriter_itemInfo
+// makes room for Needed elements, the capacity at least doubles so appending stays amortized O(1).
+// pArrayPtr is the address of the typed array pointer, it is only read and written with memcpy
+int _libtw07_datafile_writer_grow(void *pArrayPtr, int *pCapacity, int Needed, size_t ElementSize)
 {
-	int m_Type;
-	int m_ID;
-	int m_Size;
-	int m_Next;
-	int m_Prev;
-	void *m_pData;
-};
-typedef struct libtw07_datafileWriter_itemInfo libtw07_datafileWriter_itemInfo;
+	if(Needed <= *pCapacity)
+		return 0;
 
-struct libtw07_datafileWriter_itemTypeInfo
-{
-	int m_Num;
-	int m_First;
-	int m_Last;
-};
-typedef struct libtw07_datafileWriter_itemTypeInfo libtw07_datafileWriter_itemTypeInfo;
+	int Capacity = *pCapacity < LIBTW07_DATAFILE_WRITER_MIN_CAPACITY ? LIBTW07_DATAFILE_WRITER_MIN_CAPACITY : *pCapacity;
+	while(Capacity < Needed)
+		Capacity *= 2;
 
-struct libtw07_datafileWriter
-{
-	FILE *m_File;
-	int m_NumItems;
-	int m_NumDatas;
-	int m_NumItemTypes;
-	libtw07_datafileWriter_itemTypeInfo *m_pItemTypes;
-	libtw07_datafileWriter_itemInfo *m_pItems;
-	libtw07_datafileWriter_dataInfo *m_pDatas;
-};
-typedef struct libtw07_datafileWriter libtw07_datafileWriter;
+	void *pOld;
+	memcpy(&pOld, pArrayPtr, sizeof(pOld));
+	void *pArray = realloc(pOld, Capacity * ElementSize);
+	if(!pArray)
+	{
+		libtw07_print("datafile", "out of memory, could not grow to %d entries", Capacity);
+		return -1;
+	}
+	memcpy(pArrayPtr, &pArray, sizeof(pArray));
+	*pCapacity = Capacity;
+	return 0;
+}
 
-enum
+// reserves room for the expected number of items and data blocks, adding more than that still works
+int libtw07_datafile_writer_reserve(libtw07_datafileWriter *pWriter, int NumItems, int NumDatas)
 {
-	LIBTW07_DATAFILE_MAX_ITEM_TYPES=0xffff,
-	LIBTW07_DATAFILE_MAX_ITEMS=1024,
-	LIBTW07_DATAFILE_MAX_DATAS=1024,
-};
+	if(_libtw07_datafile_writer_grow(&pWriter->m_pItems, &pWriter->m_ItemsCapacity, NumItems, sizeof(libtw07_datafileWriter_itemInfo)) != 0)
+		return -1;
+	if(_libtw07_datafile_writer_grow(&pWriter->m_pDatas, &pWriter->m_DatasCapacity, NumDatas, sizeof(libtw07_datafileWriter_dataInfo)) != 0)
+		return -1;
+	return 0;
+}
 
-void libtw07_datafile_writer_init(libtw07_datafileWriter *pWriter)
+void _libtw07_datafile_writer_freeContent(libtw07_datafileWriter *pWriter)
 {
-	pWriter->m_File = 0;
-	pWriter->m_pItemTypes = (libtw07_datafileWriter_itemTypeInfo *) malloc(sizeof(libtw07_datafileWriter_itemTypeInfo) * LIBTW07_DATAFILE_MAX_ITEM_TYPES);
-	pWriter->m_pItems = (libtw07_datafileWriter_itemInfo *) malloc(sizeof(libtw07_datafileWriter_itemInfo) * LIBTW07_DATAFILE_MAX_ITEMS);
-	pWriter->m_pDatas = (libtw07_datafileWriter_dataInfo *) malloc(sizeof(libtw07_datafileWriter_dataInfo) * LIBTW07_DATAFILE_MAX_DATAS);
+	for(int i = 0; i < pWriter->m_NumItems; i++)
+		if(pWriter->m_pItems[i].m_Owned)
+			free(pWriter->m_pItems[i].m_pData);
+	for(int i = 0; i < pWriter->m_NumDatas; ++i)
+		free(pWriter->m_pDatas[i].m_pCompressedData);
+	pWriter->m_NumItems = 0;
+	pWriter->m_NumDatas = 0;
+	pWriter->m_NumItemTypes = 0;
+	free(pWriter->m_pDedupTable);
+	pWriter->m_pDedupTable = 0;
+	pWriter->m_DedupMask = 0;
+	pWriter->m_NumDeduped = 0;
 }
 
 void libtw07_datafile_writer_destroy(libtw07_datafileWriter *pWriter)
 {
+	// drop an unfinished file, no job may still use its blocks
+	if(pWriter->m_Sink)
+	{
+		_libtw07_datafile_writer_collect(pWriter);
+		_libtw07_datafile_writer_freeContent(pWriter);
+		if(pWriter->m_File)
+			fclose(pWriter->m_File);
+		pWriter->m_File = 0;
+		pWriter->m_Sink = LIBTW07_DATAFILE_SINK_NONE;
+		_libtw07_datafile_writer_closeSpill(pWriter);
+	}
 	free(pWriter->m_pItemTypes);
 	pWriter->m_pItemTypes = 0;
 	free(pWriter->m_pItems);
 	pWriter->m_pItems = 0;
 	free(pWriter->m_pDatas);
 	pWriter->m_pDatas = 0;
+	pWriter->m_ItemsCapacity = 0;
+	pWriter->m_DatasCapacity = 0;
+	pWriter->m_ItemTypesCapacity = 0;
+	free(pWriter->m_pMemory);
+	pWriter->m_pMemory = 0;
+	pWriter->m_MemorySize = 0;
+}
+
+void _libtw07_datafile_writer_start(libtw07_datafileWriter *pWriter, int Sink)
+{
+	pWriter->m_Sink = Sink;
+	pWriter->m_NumItems = 0;
+	pWriter->m_NumDatas = 0;
+	pWriter->m_NumItemTypes = 0;
+	pWriter->m_DedupStats.m_NumDuplicates = 0;
+	pWriter->m_DedupStats.m_BytesSaved = 0;
+	pWriter->m_Sha256 = SHA256_ZEROED;
+	pWriter->m_Crc = 0;
+	pWriter->m_Hashed = 0;
+	sha256_init(&pWriter->m_Sha256Ctx);
 }
 
 int libtw07_datafile_writer_open(libtw07_datafileWriter *pWriter, const char *pFilename)
 {
-	libtw07_dbg_assert(!pWriter->m_File, "a file already exists");
+	libtw07_dbg_assert(!pWriter->m_Sink, "a file already exists");
 	pWriter->m_File = fopen(pFilename, "wb");
 	if(!pWriter->m_File)
 		return -1;
 
-	pWriter->m_NumItems = 0;
-	pWriter->m_NumDatas = 0;
-	pWriter->m_NumItemTypes = 0;
-	memset(pWriter->m_pItemTypes, 0, sizeof(libtw07_datafileWriter_itemTypeInfo) * LIBTW07_DATAFILE_MAX_ITEM_TYPES);
+	_libtw07_datafile_writer_start(pWriter, LIBTW07_DATAFILE_SINK_FILE);
+	return 0;
+}
+
+// finish puts the file into one buffer of exactly the file size, take it with takeMemory
+int libtw07_datafile_writer_openMemory(libtw07_datafileWriter *pWriter)
+{
+	libtw07_dbg_assert(!pWriter->m_Sink, "a file already exists");
+	free(pWriter->m_pMemory);
+	pWriter->m_pMemory = 0;
+	pWriter->m_MemorySize = 0;
+
+	_libtw07_datafile_writer_start(pWriter, LIBTW07_DATAFILE_SINK_MEMORY);
+	return 0;
+}
+
+// finish hands the file to pfnWrite piece by piece
+int libtw07_datafile_writer_openCallback(libtw07_datafileWriter *pWriter, LIBTW07_DATAFILE_WRITEFUNC pfnWrite, void *pUser)
+{
+	libtw07_dbg_assert(!pWriter->m_Sink, "a file already exists");
+	pWriter->m_pfnWrite = pfnWrite;
+	pWriter->m_pWriteUser = pUser;
+
+	_libtw07_datafile_writer_start(pWriter, LIBTW07_DATAFILE_SINK_CALLBACK);
+	return 0;
+}
+
+// keeps compressed data blocks in a temporary file instead of memory until finish, so the
+// writer only holds the items and at most LIBTW07_DATAFILE_WRITER_SPILL_QUEUE blocks queued on
+// the job pool. has to be called after opening and before adding data
+int libtw07_datafile_writer_enableSpill(libtw07_datafileWriter *pWriter)
+{
+	libtw07_dbg_assert(pWriter->m_Sink && pWriter->m_NumDatas == 0, "spilling has to be enabled before adding data");
+	if(pWriter->m_SpillFile)
+		return 0;
+
+	pWriter->m_SpillFile = tmpfile();
+	if(!pWriter->m_SpillFile)
+	{
+		libtw07_print("datafile", "could not create the spill file");
+		return -1;
+	}
+	pWriter->m_SpillSize = 0;
+	pWriter->m_NumSpilled = 0;
+	pWriter->m_SpillFailed = 0;
+	return 0;
+}
+
+// returns the file written by a memory writer, the caller has to free() it. returns 0 when
+// finish failed or was not called
+void *libtw07_datafile_writer_takeMemory(libtw07_datafileWriter *pWriter, int *pSize)
+{
+	void *pMemory = pWriter->m_pMemory;
+	if(pSize)
+		*pSize = pWriter->m_MemorySize;
+	pWriter->m_pMemory = 0;
+	pWriter->m_MemorySize = 0;
+	return pMemory;
+}
+
+int _libtw07_datafile_writer_write(libtw07_datafileWriter *pWriter, const void *pData, int Size)
+{
+	sha256_update(&pWriter->m_Sha256Ctx, pData, Size);
+	pWriter->m_Crc = crc32(pWriter->m_Crc, (const unsigned char *)pData, Size);
 
-	for(int i = 0; i < LIBTW07_DATAFILE_MAX_ITEM_TYPES; i++)
+	switch(pWriter->m_Sink)
 	{
-		pWriter->m_pItemTypes[i].m_First = -1;
-		pWriter->m_pItemTypes[i].m_Last = -1;
+	case LIBTW07_DATAFILE_SINK_FILE:
+		return fwrite(pData, 1, Size, pWriter->m_File) == (size_t)Size ? 0 : -1;
+	case LIBTW07_DATAFILE_SINK_MEMORY:
+		// the buffer is allocated with the full size before anything is written
+		if(pData != pWriter->m_pMemory + pWriter->m_MemorySize)
+			memcpy(pWriter->m_pMemory + pWriter->m_MemorySize, pData, Size);
+		pWriter->m_MemorySize += Size;
+		return 0;
+	case LIBTW07_DATAFILE_SINK_CALLBACK:
+		return pWriter->m_pfnWrite(pWriter->m_pWriteUser, pData, Size);
 	}
+	return -1;
+}
 
+// copies a spilled block from the spill file to the output
+int _libtw07_datafile_writer_writeSpilled(libtw07_datafileWriter *pWriter, const libtw07_datafileWriter_dataInfo *pInfo)
+{
+	if(_libtw07_datafile_seek(pWriter->m_SpillFile, pInfo->m_SpillOffset) != 0)
+		return -1;
+
+	char aBuf[64*1024];
+	int Left = pInfo->m_CompressedSize;
+	while(Left > 0)
+	{
+		int Chunk = Left < (int)sizeof(aBuf) ? Left : (int)sizeof(aBuf);
+		if(fread(aBuf, 1, Chunk, pWriter->m_SpillFile) != (size_t)Chunk)
+			return -1;
+		if(_libtw07_datafile_writer_write(pWriter, aBuf, Chunk) != 0)
+			return -1;
+		Left -= Chunk;
+	}
 	return 0;
 }
 
-int libtw07_datafile_writer_addItem(libtw07_datafileWriter *pWriter, int Type, int ID, int Size, const void *pData)
+// returns the entry of Type, it is inserted in order when it is not used yet
+libtw07_datafileWriter_itemTypeInfo *_libtw07_datafile_writer_findType(libtw07_datafileWriter *pWriter, int Type)
+{
+	int Low = 0;
+	int High = pWriter->m_NumItemTypes;
+	while(Low < High)
+	{
+		int Mid = (Low + High) / 2;
+		if(pWriter->m_pItemTypes[Mid].m_Type < Type)
+			Low = Mid + 1;
+		else
+			High = Mid;
+	}
+	if(Low < pWriter->m_NumItemTypes && pWriter->m_pItemTypes[Low].m_Type == Type)
+		return &pWriter->m_pItemTypes[Low];
+
+	if(_libtw07_datafile_writer_grow(&pWriter->m_pItemTypes, &pWriter->m_ItemTypesCapacity, pWriter->m_NumItemTypes+1, sizeof(libtw07_datafileWriter_itemTypeInfo)) != 0)
+		return 0;
+	memmove(&pWriter->m_pItemTypes[Low+1], &pWriter->m_pItemTypes[Low], (pWriter->m_NumItemTypes - Low) * sizeof(libtw07_datafileWriter_itemTypeInfo));
+	pWriter->m_NumItemTypes++;
+
+	libtw07_datafileWriter_itemTypeInfo *pInfo = &pWriter->m_pItemTypes[Low];
+	pInfo->m_Type = Type;
+	pInfo->m_Num = 0;
+	pInfo->m_First = -1;
+	pInfo->m_Last = -1;
+	return pInfo;
+}
+
+// returns the item index or -1, a taken buffer stays with the caller on failure
+int libtw07_datafile_writer_addItemEx(libtw07_datafileWriter *pWriter, int Type, int ID, int Size, const void *pData, int Ownership)
 {
-	if(!pWriter->m_File) return 0;
+	if(!pWriter->m_Sink) return -1;
 
 	libtw07_dbg_assert(Type >= 0 && Type < 0xFFFF, "incorrect type");
-	libtw07_dbg_assert(pWriter->m_NumItems < 1024, "too many items");
 	libtw07_dbg_assert(Size%sizeof(int) == 0, "incorrect boundary");
 
+	if(_libtw07_datafile_writer_grow(&pWriter->m_pItems, &pWriter->m_ItemsCapacity, pWriter->m_NumItems+1, sizeof(libtw07_datafileWriter_itemInfo)) != 0)
+		return -1;
+
+	void *pCopy = 0;
+	if(Ownership == LIBTW07_DATAFILE_BUFFER_COPY)
+	{
+		// copy data
+		pCopy = malloc(Size + 1);
+		if(!pCopy)
+			return -1;
+		memcpy(pCopy, pData, Size);
+		pData = pCopy;
+	}
+
+	// a new type is inserted right away, so this comes last and nothing can fail after it
+	libtw07_datafileWriter_itemTypeInfo *pType = _libtw07_datafile_writer_findType(pWriter, Type);
+	if(!pType)
+	{
+		free(pCopy);
+		return -1;
+	}
+
 	pWriter->m_pItems[pWriter->m_NumItems].m_Type = Type;
 	pWriter->m_pItems[pWriter->m_NumItems].m_ID = ID;
 	pWriter->m_pItems[pWriter->m_NumItems].m_Size = Size;
-
-	// copy data
-	pWriter->m_pItems[pWriter->m_NumItems].m_pData = malloc(Size);
-	memcpy(pWriter->m_pItems[pWriter->m_NumItems].m_pData, pData, Size);
-
-	if(!pWriter->m_pItemTypes[Type].m_Num) // count item types
-		pWriter->m_NumItemTypes++;
+	pWriter->m_pItems[pWriter->m_NumItems].m_pData = (void *)pData;
+	pWriter->m_pItems[pWriter->m_NumItems].m_Owned = Ownership != LIBTW07_DATAFILE_BUFFER_BORROW;
 
 	// link
-	pWriter->m_pItems[pWriter->m_NumItems].m_Prev = pWriter->m_pItemTypes[Type].m_Last;
+	pWriter->m_pItems[pWriter->m_NumItems].m_Prev = pType->m_Last;
 	pWriter->m_pItems[pWriter->m_NumItems].m_Next = -1;
 
-	if(pWriter->m_pItemTypes[Type].m_Last != -1)
-		pWriter->m_pItems[pWriter->m_pItemTypes[Type].m_Last].m_Next = pWriter->m_NumItems;
-	pWriter->m_pItemTypes[Type].m_Last = pWriter->m_NumItems;
+	if(pType->m_Last != -1)
+		pWriter->m_pItems[pType->m_Last].m_Next = pWriter->m_NumItems;
+	pType->m_Last = pWriter->m_NumItems;
 
-	if(pWriter->m_pItemTypes[Type].m_First == -1)
-		pWriter->m_pItemTypes[Type].m_First = pWriter->m_NumItems;
+	if(pType->m_First == -1)
+		pType->m_First = pWriter->m_NumItems;
 
-	pWriter->m_pItemTypes[Type].m_Num++;
+	pType->m_Num++;
 
 	pWriter->m_NumItems++;
 	return pWriter->m_NumItems-1;
 }
 
-int libtw07_datafile_writer_addData(libtw07_datafileWriter *pWriter, int Size, const void *pData)
+int libtw07_datafile_writer_addItem(libtw07_datafileWriter *pWriter, int Type, int ID, int Size, const void *pData)
+{
+	return libtw07_datafile_writer_addItemEx(pWriter, Type, ID, Size, pData, LIBTW07_DATAFILE_BUFFER_COPY);
+}
+
+// returns the data index or -1. a taken buffer is freed right after compression, a borrowed one
+// is only kept until then. on failure the writer does not take the buffer, the caller frees it
+int libtw07_datafile_writer_addDataEx(libtw07_datafileWriter *pWriter, int Size, const void *pData, int Level, int Strategy, int Ownership)
 {
-	if(!pWriter->m_File) return 0;
+	if(!pWriter->m_Sink) return -1;
 
-	libtw07_dbg_assert(pWriter->m_NumDatas < 1024, "too much data");
+	if(_libtw07_datafile_writer_grow(&pWriter->m_pDatas, &pWriter->m_DatasCapacity, pWriter->m_NumDatas+1, sizeof(libtw07_datafileWriter_dataInfo)) != 0)
+		return -1;
 
 	libtw07_datafileWriter_dataInfo *pInfo = &pWriter->m_pDatas[pWriter->m_NumDatas];
-	uLong s = compressBound(Size);
-	void *pCompData = malloc(s); // temporary buffer that we use during compression
+	pInfo->m_UncompressedSize = Size;
+	pInfo->m_CompressedSize = 0;
+	pInfo->m_pCompressedData = 0;
+	pInfo->m_pTask = 0;
+	pInfo->m_SpillOffset = -1;
 
-	int Result = compress((Bytef*)pCompData, &s, (Bytef*)pData, Size);
-	if(Result != Z_OK)
+	int *pDedupSlot = 0;
+	if(pWriter->m_Dedup)
 	{
-		libtw07_print("datafile", "compression error %d", Result);
-		libtw07_dbg_assert(0, "zlib error");
+		if(_libtw07_datafile_writer_dedupGrow(pWriter) != 0)
+		{
+			libtw07_print("datafile", "out of memory, could not add data");
+			return -1;
+		}
+		pInfo->m_Hash = sha256(pData, Size);
+		pDedupSlot = _libtw07_datafile_writer_dedupSlot(pWriter, &pInfo->m_Hash, Size);
+		if(*pDedupSlot != -1)
+		{
+			pWriter->m_DedupStats.m_NumDuplicates++;
+			pWriter->m_DedupStats.m_BytesSaved += Size;
+			if(Ownership == LIBTW07_DATAFILE_BUFFER_TAKE)
+				free((void *)pData);
+			return *pDedupSlot;
+		}
 	}
 
-	pInfo->m_UncompressedSize = Size;
-	pInfo->m_CompressedSize = (int)s;
-	pInfo->m_pCompressedData = malloc(pInfo->m_CompressedSize);
-	memcpy(pInfo->m_pCompressedData, pCompData, pInfo->m_CompressedSize);
-	free(pCompData);
+	if(pWriter->m_pPool)
+	{
+		// let the pool compress the block, a copy is only needed when the caller keeps it
+		libtw07_datafileWriter_compressTask *pTask = (libtw07_datafileWriter_compressTask *) malloc(sizeof(libtw07_datafileWriter_compressTask));
+		void *pCopy = 0;
+		if(Ownership == LIBTW07_DATAFILE_BUFFER_COPY)
+			pCopy = malloc(Size + 1);
+		if(!pTask || (Ownership == LIBTW07_DATAFILE_BUFFER_COPY && !pCopy))
+		{
+			free(pTask);
+			free(pCopy);
+			libtw07_print("datafile", "out of memory, could not queue data");
+			return -1;
+		}
+		if(pCopy)
+		{
+			memcpy(pCopy, pData, Size);
+			pData = pCopy;
+		}
+		pTask->m_pSrc = pData;
+		pTask->m_SrcSize = Size;
+		pTask->m_FreeSrc = Ownership != LIBTW07_DATAFILE_BUFFER_BORROW;
+		pTask->m_pDst = 0;
+		pTask->m_DstSize = 0;
+		pTask->m_Level = Level;
+		pTask->m_Strategy = Strategy;
+		pInfo->m_pTask = pTask;
+		libtw07_jobpool_add(pWriter->m_pPool, &pTask->m_Job, _libtw07_datafile_writer_compressJob, pTask);
+	}
+	else
+	{
+		int Result = _libtw07_datafile_writer_compress(pData, Size, Level, Strategy, &pInfo->m_pCompressedData, &pInfo->m_CompressedSize);
+		if(Result != Z_OK)
+		{
+			libtw07_print("datafile", "compression error %d", Result);
+			libtw07_dbg_assert(0, "zlib error");
+		}
+		if(Ownership == LIBTW07_DATAFILE_BUFFER_TAKE)
+			free((void *)pData);
+	}
 
+	if(pDedupSlot)
+	{
+		*pDedupSlot = pWriter->m_NumDatas;
+		pWriter->m_NumDeduped++;
+	}
 	pWriter->m_NumDatas++;
+	if(pWriter->m_SpillFile)
+		_libtw07_datafile_writer_spill(pWriter);
 	return pWriter->m_NumDatas-1;
 }
 
+int libtw07_datafile_writer_addData(libtw07_datafileWriter *pWriter, int Size, const void *pData)
+{
+	return libtw07_datafile_writer_addDataEx(pWriter, Size, pData, pWriter->m_Level, pWriter->m_Strategy, LIBTW07_DATAFILE_BUFFER_COPY);
+}
+
 int libtw07_datafile_writer_addDataSwapped(libtw07_datafileWriter *pWriter, int Size, const void *pData)
 {
 	libtw07_dbg_assert(Size%sizeof(int) == 0, "incorrect boundary");
@@ -695,20 +2703,91 @@ int libtw07_datafile_writer_addDataSwapped(libtw07_datafileWriter *pWriter, int
 #endif
 }
 
+// copies data block Index of a v4 file without inflating and deflating it again.
+// the block is taken as stored in the file, data replaced in the reader is not used
+int libtw07_datafile_writer_addRawData(libtw07_datafileWriter *pWriter, libtw07_datafileReader *pReader, int Index)
+{
+	if(!pWriter->m_Sink) return -1;
+
+	libtw07_datafile *pDataFile = pReader->m_pDataFile;
+	if(!pDataFile || Index < 0 || Index >= pDataFile->m_Header.m_NumRawData)
+		return -1;
+
+	int DataSize = _libtw07_datafile_reader_getFileDataSize(pReader, Index);
+	if(DataSize < 0)
+	{
+		libtw07_print("datafile", "data index=%d has an invalid size", Index);
+		return -1;
+	}
+
+	void *pRaw = malloc(DataSize + 1);
+	if(!pRaw)
+	{
+		libtw07_print("datafile", "out of memory, could not copy data index=%d", Index);
+		return -1;
+	}
+
+	int Failed;
+	if(pDataFile->m_pMapped)
+	{
+		unsigned char *pMapped = _libtw07_datafile_reader_mapData(pDataFile, Index, DataSize);
+		if(pMapped)
+			memcpy(pRaw, pMapped, DataSize);
+		Failed = !pMapped;
+	}
+	else
+		Failed = _libtw07_datafile_reader_readData(pDataFile, Index, pRaw, DataSize) != 0;
+	if(Failed)
+	{
+		libtw07_print("datafile", "could not read data index=%d", Index);
+		free(pRaw);
+		return -1;
+	}
+
+	// older files store their blocks uncompressed, those have to go through the compressor
+	if(pDataFile->m_Header.m_Version != 4)
+	{
+		int DataIndex = libtw07_datafile_writer_addDataEx(pWriter, DataSize, pRaw, pWriter->m_Level, pWriter->m_Strategy, LIBTW07_DATAFILE_BUFFER_TAKE);
+		if(DataIndex < 0)
+			free(pRaw);
+		return DataIndex;
+	}
+
+	if(_libtw07_datafile_writer_grow(&pWriter->m_pDatas, &pWriter->m_DatasCapacity, pWriter->m_NumDatas+1, sizeof(libtw07_datafileWriter_dataInfo)) != 0)
+	{
+		free(pRaw);
+		return -1;
+	}
+
+	libtw07_datafileWriter_dataInfo *pInfo = &pWriter->m_pDatas[pWriter->m_NumDatas];
+	pInfo->m_UncompressedSize = pDataFile->m_Info.m_pDataSizes[Index];
+	pInfo->m_CompressedSize = DataSize;
+	pInfo->m_pCompressedData = pRaw;
+	pInfo->m_pTask = 0;
+	pInfo->m_SpillOffset = -1;
+
+	pWriter->m_NumDatas++;
+	if(pWriter->m_SpillFile)
+		_libtw07_datafile_writer_spill(pWriter);
+	return pWriter->m_NumDatas-1;
+}
+
 
 int libtw07_datafile_writer_finish(libtw07_datafileWriter *pWriter)
 {
-	if(!pWriter->m_File) return 0;
+	if(!pWriter->m_Sink) return 0;
 
 	int ItemSize = 0;
 	int TypesSize, HeaderSize, OffsetSize, FileSize, SwapSize;
 	int DataSize = 0;
-	libtw07_datafileHeader Header;
 
 	// we should now write this file!
 	if(LIBTW07_DATAFILE_DEBUG)
 		libtw07_print("datafile", "writing");
 
+	// the sizes of queued blocks are needed for the offsets
+	_libtw07_datafile_writer_collect(pWriter);
+
 	// calculate sizes
 	for(int i = 0; i < pWriter->m_NumItems; i++)
 	{
@@ -728,154 +2807,144 @@ int libtw07_datafile_writer_finish(libtw07_datafileWriter *pWriter)
 	FileSize = HeaderSize + TypesSize + OffsetSize + ItemSize + DataSize;
 	SwapSize = FileSize - DataSize;
 
-	(void)SwapSize;
-
 	if(LIBTW07_DATAFILE_DEBUG)
 		libtw07_print("datafile", "num_m_aItemTypes=%d TypesSize=%d m_aItemsize=%d DataSize=%d", pWriter->m_NumItemTypes, TypesSize, ItemSize, DataSize);
 
-	// construct Header
+	// everything in front of the data is put together in one buffer and written at once,
+	// in memory that buffer is the start of the file itself
+	char *pBuffer = (char *) malloc(pWriter->m_Sink == LIBTW07_DATAFILE_SINK_MEMORY ? FileSize : SwapSize);
+	if(!pBuffer)
 	{
-		Header.m_aID[0] = 'D';
-		Header.m_aID[1] = 'A';
-		Header.m_aID[2] = 'T';
-		Header.m_aID[3] = 'A';
-		Header.m_Version = 4;
-		Header.m_Size = FileSize - 16;
-		Header.m_Swaplen = SwapSize - 16;
-		Header.m_NumItemTypes = pWriter->m_NumItemTypes;
-		Header.m_NumItems = pWriter->m_NumItems;
-		Header.m_NumRawData = pWriter->m_NumDatas;
-		Header.m_ItemSize = ItemSize;
-		Header.m_DataSize = DataSize;
-
-		// write Header
-		if(LIBTW07_DATAFILE_DEBUG)
-			libtw07_print("datafile", "HeaderSize=%d", (int)sizeof(Header));
-#if defined(CONF_ARCH_ENDIAN_BIG)
-		swap_endian(&Header, sizeof(int), sizeof(Header)/sizeof(int));
-#endif
-		fwrite(&Header, 1, sizeof(Header), pWriter->m_File);
+		libtw07_print("datafile", "out of memory, could not write the file");
+		return 0;
 	}
-
-	// write types
-	for(int i = 0, Count = 0; i < 0xffff; i++)
+	if(pWriter->m_Sink == LIBTW07_DATAFILE_SINK_MEMORY)
 	{
-		if(pWriter->m_pItemTypes[i].m_Num)
-		{
-			// write info
-			libtw07_datafileItemType Info;
-			Info.m_Type = i;
-			Info.m_Start = Count;
-			Info.m_Num = pWriter->m_pItemTypes[i].m_Num;
-			if(LIBTW07_DATAFILE_DEBUG)
-				libtw07_print("datafile", "writing type=%x start=%d num=%d", Info.m_Type, Info.m_Start, Info.m_Num);
-#if defined(CONF_ARCH_ENDIAN_BIG)
-			swap_endian(&Info, sizeof(int), sizeof(libtw07_datafileItemType)/sizeof(int));
-#endif
-			fwrite(&Info, 1, sizeof(Info), pWriter->m_File);
-			Count += pWriter->m_pItemTypes[i].m_Num;
-		}
+		pWriter->m_pMemory = pBuffer;
+		pWriter->m_MemorySize = 0;
 	}
 
-	// write item offsets
-	for(int i = 0, Offset = 0; i < 0xffff; i++)
+	// construct Header
+	libtw07_datafileHeader *pHeader = (libtw07_datafileHeader *)pBuffer;
 	{
-		if(pWriter->m_pItemTypes[i].m_Num)
-		{
-			// write all m_pItems in of this type
-			int k = pWriter->m_pItemTypes[i].m_First;
-			while(k != -1)
-			{
-				if(LIBTW07_DATAFILE_DEBUG)
-					libtw07_print("datafile", "writing item offset num=%d offset=%d", k, Offset);
-				int Temp = Offset;
-#if defined(CONF_ARCH_ENDIAN_BIG)
-				swap_endian(&Temp, sizeof(int), sizeof(Temp)/sizeof(int));
-#endif
-				fwrite(&Temp, 1, sizeof(Temp), pWriter->m_File);
-				Offset += pWriter->m_pItems[k].m_Size + sizeof(libtw07_datafileItem);
+		pHeader->m_aID[0] = 'D';
+		pHeader->m_aID[1] = 'A';
+		pHeader->m_aID[2] = 'T';
+		pHeader->m_aID[3] = 'A';
+		pHeader->m_Version = 4;
+		pHeader->m_Size = FileSize - 16;
+		pHeader->m_Swaplen = SwapSize - 16;
+		pHeader->m_NumItemTypes = pWriter->m_NumItemTypes;
+		pHeader->m_NumItems = pWriter->m_NumItems;
+		pHeader->m_NumRawData = pWriter->m_NumDatas;
+		pHeader->m_ItemSize = ItemSize;
+		pHeader->m_DataSize = DataSize;
 
-				// next
-				k = pWriter->m_pItems[k].m_Next;
-			}
-		}
+		if(LIBTW07_DATAFILE_DEBUG)
+			libtw07_print("datafile", "HeaderSize=%d", (int)sizeof(libtw07_datafileHeader));
 	}
 
-	// write data offsets
-	for(int i = 0, Offset = 0; i < pWriter->m_NumDatas; i++)
+	libtw07_datafileItemType *pTypes = (libtw07_datafileItemType *)(pHeader+1);
+	int *pItemOffsets = (int *)(pTypes + pWriter->m_NumItemTypes);
+	int *pDataOffsets = pItemOffsets + pWriter->m_NumItems;
+	int *pUncompressedSizes = pDataOffsets + pWriter->m_NumDatas;
+	char *pItems = (char *)(pUncompressedSizes + pWriter->m_NumDatas);
+
+	// types, item offsets and items, the types are sorted already
+	for(int i = 0, Count = 0, Offset = 0; i < pWriter->m_NumItemTypes; i++)
 	{
+		libtw07_datafileItemType *pInfo = &pTypes[i];
+		pInfo->m_Type = pWriter->m_pItemTypes[i].m_Type;
+		pInfo->m_Start = Count;
+		pInfo->m_Num = pWriter->m_pItemTypes[i].m_Num;
 		if(LIBTW07_DATAFILE_DEBUG)
-			libtw07_print("datafile", "writing data offset num=%d offset=%d", i, Offset);
-		int Temp = Offset;
-#if defined(CONF_ARCH_ENDIAN_BIG)
-		swap_endian(&Temp, sizeof(int), sizeof(Temp)/sizeof(int));
-#endif
-		fwrite(&Temp, 1, sizeof(Temp), pWriter->m_File);
-		Offset += pWriter->m_pDatas[i].m_CompressedSize;
+			libtw07_print("datafile", "writing type=%x start=%d num=%d", pInfo->m_Type, pInfo->m_Start, pInfo->m_Num);
+
+		// all items of this type
+		for(int k = pWriter->m_pItemTypes[i].m_First; k != -1; k = pWriter->m_pItems[k].m_Next)
+		{
+			if(LIBTW07_DATAFILE_DEBUG)
+				libtw07_print("datafile", "writing item type=%x idx=%d id=%d size=%d offset=%d", pInfo->m_Type, k, pWriter->m_pItems[k].m_ID, pWriter->m_pItems[k].m_Size, Offset);
+			pItemOffsets[Count++] = Offset;
+
+			libtw07_datafileItem *pItem = (libtw07_datafileItem *)(pItems + Offset);
+			pItem->m_TypeAndID = (pInfo->m_Type<<16)|pWriter->m_pItems[k].m_ID;
+			pItem->m_Size = pWriter->m_pItems[k].m_Size;
+			memcpy(pItem+1, pWriter->m_pItems[k].m_pData, pWriter->m_pItems[k].m_Size);
+			Offset += pWriter->m_pItems[k].m_Size + sizeof(libtw07_datafileItem);
+		}
 	}
 
-	// write data uncompressed sizes
-	for(int i = 0; i < pWriter->m_NumDatas; i++)
+	// data offsets and uncompressed sizes
+	for(int i = 0, Offset = 0; i < pWriter->m_NumDatas; i++)
 	{
 		if(LIBTW07_DATAFILE_DEBUG)
-			libtw07_print("datafile", "writing data uncompressed size num=%d size=%d", i, pWriter->m_pDatas[i].m_UncompressedSize);
-		int UncompressedSize = pWriter->m_pDatas[i].m_UncompressedSize;
-#if defined(CONF_ARCH_ENDIAN_BIG)
-		swap_endian(&UncompressedSize, sizeof(int), sizeof(UncompressedSize)/sizeof(int));
-#endif
-		fwrite(&UncompressedSize, 1, sizeof(UncompressedSize), pWriter->m_File);
+			libtw07_print("datafile", "writing data num=%d offset=%d uncompressed size=%d", i, Offset, pWriter->m_pDatas[i].m_UncompressedSize);
+		pDataOffsets[i] = Offset;
+		pUncompressedSizes[i] = pWriter->m_pDatas[i].m_UncompressedSize;
+		Offset += pWriter->m_pDatas[i].m_CompressedSize;
 	}
 
-	// write m_pItems
-	for(int i = 0; i < 0xffff; i++)
-	{
-		if(pWriter->m_pItemTypes[i].m_Num)
-		{
-			// write all m_pItems in of this type
-			int k = pWriter->m_pItemTypes[i].m_First;
-			while(k != -1)
-			{
-				libtw07_datafileItem Item;
-				Item.m_TypeAndID = (i<<16)|pWriter->m_pItems[k].m_ID;
-				Item.m_Size = pWriter->m_pItems[k].m_Size;
-				if(LIBTW07_DATAFILE_DEBUG)
-					libtw07_print("datafile", "writing item type=%x idx=%d id=%d size=%d", i, k, pWriter->m_pItems[k].m_ID, pWriter->m_pItems[k].m_Size);
-
 #if defined(CONF_ARCH_ENDIAN_BIG)
-				swap_endian(&Item, sizeof(int), sizeof(Item)/sizeof(int));
-				swap_endian(pWriter->m_pItems[k].m_pData, sizeof(int), pWriter->m_pItems[k].m_Size/sizeof(int));
+	swap_endian(pBuffer, sizeof(int), SwapSize/sizeof(int));
 #endif
-				fwrite(&Item, 1, sizeof(Item), pWriter->m_File);
-				fwrite(pWriter->m_pItems[k].m_pData, 1, pWriter->m_pItems[k].m_Size, pWriter->m_File);
+	int Failed = _libtw07_datafile_writer_write(pWriter, pBuffer, SwapSize) != 0;
+	if(pWriter->m_Sink != LIBTW07_DATAFILE_SINK_MEMORY)
+		free(pBuffer);
 
-				// next
-				k = pWriter->m_pItems[k].m_Next;
-			}
-		}
-	}
+	if(pWriter->m_SpillFile)
+		Failed |= pWriter->m_SpillFailed || fflush(pWriter->m_SpillFile) != 0;
 
-	// write data
-	for(int i = 0; i < pWriter->m_NumDatas; i++)
+	// write data, spilled blocks are read back from wherever they ended up in the spill file
+	for(int i = 0; i < pWriter->m_NumDatas && !Failed; i++)
 	{
 		if(LIBTW07_DATAFILE_DEBUG)
 			libtw07_print("datafile", "writing data id=%d size=%d", i, pWriter->m_pDatas[i].m_CompressedSize);
-		fwrite(pWriter->m_pDatas[i].m_pCompressedData, 1, pWriter->m_pDatas[i].m_CompressedSize, pWriter->m_File);
+		if(pWriter->m_pDatas[i].m_SpillOffset >= 0)
+			Failed = _libtw07_datafile_writer_writeSpilled(pWriter, &pWriter->m_pDatas[i]) != 0;
+		else
+			Failed = _libtw07_datafile_writer_write(pWriter, pWriter->m_pDatas[i].m_pCompressedData, pWriter->m_pDatas[i].m_CompressedSize) != 0;
 	}
 
-	// free data
-	for(int i = 0; i < pWriter->m_NumItems; i++)
-		free(pWriter->m_pItems[i].m_pData);
-	for(int i = 0; i < pWriter->m_NumDatas; ++i)
-		free(pWriter->m_pDatas[i].m_pCompressedData);
+	_libtw07_datafile_writer_freeContent(pWriter);
+	_libtw07_datafile_writer_closeSpill(pWriter);
 
-	fclose(pWriter->m_File);
+	if(pWriter->m_File && fclose(pWriter->m_File) != 0)
+		Failed = 1;
 	pWriter->m_File = NULL;
+	pWriter->m_Sink = LIBTW07_DATAFILE_SINK_NONE;
+
+	if(Failed)
+	{
+		// a half written file in memory must not be handed out by takeMemory
+		free(pWriter->m_pMemory);
+		pWriter->m_pMemory = 0;
+		pWriter->m_MemorySize = 0;
+		libtw07_print("datafile", "failed to write the file");
+		return 0;
+	}
+
+	pWriter->m_Sha256 = sha256_finish(&pWriter->m_Sha256Ctx);
+	pWriter->m_Hashed = 1;
 
 	if(LIBTW07_DATAFILE_DEBUG)
 		libtw07_print("datafile", "done");
 	return 1;
 }
 
+// hashes of the file written by the last successful finish, the same the reader reports for it
+SHA256_DIGEST libtw07_datafile_writer_sha256(libtw07_datafileWriter *pWriter)
+{
+	if(!pWriter->m_Hashed) return SHA256_ZEROED;
+	return pWriter->m_Sha256;
+}
+
+uint32_t libtw07_datafile_writer_crc(libtw07_datafileWriter *pWriter)
+{
+	if(!pWriter->m_Hashed) return 0xFFFFFFFF;
+	return pWriter->m_Crc;
+}
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,236 @@
+/*
+ * This file is part of libtw07, a header-only library for teeworlds0.7.
+ *
+ * Orignal Code by:
+ * Copyright (C) 2007-2025 Magnus Auvinen
+ *
+ * Libtw07 Library:
+ * Copyright (C) 2025 TeeworldsArchive
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty. In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ *
+ * Note: This is an altered version — a C language port of the original C++ implementation.
+ */
+#ifndef LIBTW07_JOBS_H
+#define LIBTW07_JOBS_H
+
+#include <stdlib.h>
+
+#include "print.h"
+#include "thread.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef int (*LIBTW07_JOBFUNC)(void *pData);
+
+struct libtw07_jobPool;
+
+struct libtw07_job
+{
+	struct libtw07_jobPool *m_pPool;
+	struct libtw07_job *m_pPrev;
+	struct libtw07_job *m_pNext;
+
+	volatile int m_Status;
+	volatile int m_Result;
+
+	LIBTW07_JOBFUNC m_pfnFunc;
+	void *m_pFuncData;
+};
+typedef struct libtw07_job libtw07_job;
+
+enum
+{
+	LIBTW07_JOB_STATE_PENDING=0,
+	LIBTW07_JOB_STATE_RUNNING,
+	LIBTW07_JOB_STATE_DONE,
+};
+
+struct libtw07_jobPool
+{
+	libtw07_lock m_Lock;
+	libtw07_cond m_JobAdded;
+	libtw07_cond m_JobDone;
+	libtw07_job *m_pFirstJob;
+	libtw07_job *m_pLastJob;
+
+	int m_NumThreads;
+	void **m_ppThreads;
+	int m_Shutdown;
+};
+typedef struct libtw07_jobPool libtw07_jobPool;
+
+int libtw07_job_status(libtw07_job *pJob)
+{
+	return libtw07_atomic_load(&pJob->m_Status);
+}
+
+int libtw07_job_result(libtw07_job *pJob)
+{
+	return libtw07_atomic_load(&pJob->m_Result);
+}
+
+// takes the first pending job, the pool lock must be held
+libtw07_job *_libtw07_jobpool_pop(libtw07_jobPool *pPool)
+{
+	libtw07_job *pJob = pPool->m_pFirstJob;
+	if(!pJob)
+		return 0;
+
+	pPool->m_pFirstJob = pJob->m_pNext;
+	if(pPool->m_pFirstJob)
+		pPool->m_pFirstJob->m_pPrev = 0;
+	else
+		pPool->m_pLastJob = 0;
+
+	libtw07_atomic_store(&pJob->m_Status, LIBTW07_JOB_STATE_RUNNING);
+	return pJob;
+}
+
+// runs a job that was popped, the pool lock must be held and is released while running it
+void _libtw07_jobpool_run(libtw07_jobPool *pPool, libtw07_job *pJob)
+{
+	libtw07_lock_unlock(&pPool->m_Lock);
+	int Result = pJob->m_pfnFunc(pJob->m_pFuncData);
+	libtw07_lock_wait(&pPool->m_Lock);
+
+	libtw07_atomic_store(&pJob->m_Result, Result);
+	libtw07_atomic_store(&pJob->m_Status, LIBTW07_JOB_STATE_DONE);
+	libtw07_cond_broadcast(&pPool->m_JobDone);
+}
+
+void _libtw07_jobpool_workerThread(void *pUser)
+{
+	libtw07_jobPool *pPool = (libtw07_jobPool *)pUser;
+
+	libtw07_lock_wait(&pPool->m_Lock);
+	while(1)
+	{
+		libtw07_job *pJob = _libtw07_jobpool_pop(pPool);
+		if(pJob)
+			_libtw07_jobpool_run(pPool, pJob);
+		else if(pPool->m_Shutdown)
+			break;
+		else
+			libtw07_cond_wait(&pPool->m_JobAdded, &pPool->m_Lock);
+	}
+	libtw07_lock_unlock(&pPool->m_Lock);
+}
+
+// starts NumThreads workers, one per cpu when NumThreads is 0 or less
+int libtw07_jobpool_init(libtw07_jobPool *pPool, int NumThreads)
+{
+	if(NumThreads <= 0)
+		NumThreads = libtw07_cpu_count();
+
+	libtw07_lock_init(&pPool->m_Lock);
+	libtw07_cond_init(&pPool->m_JobAdded);
+	libtw07_cond_init(&pPool->m_JobDone);
+	pPool->m_pFirstJob = 0;
+	pPool->m_pLastJob = 0;
+	pPool->m_Shutdown = 0;
+	pPool->m_NumThreads = 0;
+	pPool->m_ppThreads = (void **) malloc(NumThreads * sizeof(void *));
+	if(!pPool->m_ppThreads)
+		return -1;
+
+	for(int i = 0; i < NumThreads; i++)
+	{
+		pPool->m_ppThreads[i] = libtw07_thread_init(_libtw07_jobpool_workerThread, pPool);
+		if(!pPool->m_ppThreads[i])
+		{
+			libtw07_print("jobs", "failed to start worker thread %d", i);
+			break;
+		}
+		pPool->m_NumThreads++;
+	}
+	return 0;
+}
+
+// runs what is still queued and stops the workers
+void libtw07_jobpool_destroy(libtw07_jobPool *pPool)
+{
+	libtw07_lock_wait(&pPool->m_Lock);
+	pPool->m_Shutdown = 1;
+	libtw07_cond_broadcast(&pPool->m_JobAdded);
+	libtw07_lock_unlock(&pPool->m_Lock);
+
+	for(int i = 0; i < pPool->m_NumThreads; i++)
+		libtw07_thread_wait(pPool->m_ppThreads[i]);
+	free(pPool->m_ppThreads);
+	pPool->m_ppThreads = 0;
+	pPool->m_NumThreads = 0;
+
+	// a pool without workers still has to finish its jobs
+	libtw07_lock_wait(&pPool->m_Lock);
+	libtw07_job *pJob;
+	while((pJob = _libtw07_jobpool_pop(pPool)))
+		_libtw07_jobpool_run(pPool, pJob);
+	libtw07_lock_unlock(&pPool->m_Lock);
+
+	libtw07_cond_destroy(&pPool->m_JobDone);
+	libtw07_cond_destroy(&pPool->m_JobAdded);
+	libtw07_lock_destroy(&pPool->m_Lock);
+}
+
+int libtw07_jobpool_add(libtw07_jobPool *pPool, libtw07_job *pJob, LIBTW07_JOBFUNC pfnFunc, void *pData)
+{
+	pJob->m_pPool = pPool;
+	pJob->m_pfnFunc = pfnFunc;
+	pJob->m_pFuncData = pData;
+	pJob->m_Result = 0;
+	libtw07_atomic_store(&pJob->m_Status, LIBTW07_JOB_STATE_PENDING);
+
+	libtw07_lock_wait(&pPool->m_Lock);
+
+	// add job to queue
+	pJob->m_pPrev = pPool->m_pLastJob;
+	pJob->m_pNext = 0;
+	if(pPool->m_pLastJob)
+		pPool->m_pLastJob->m_pNext = pJob;
+	pPool->m_pLastJob = pJob;
+	if(!pPool->m_pFirstJob)
+		pPool->m_pFirstJob = pJob;
+
+	libtw07_cond_signal(&pPool->m_JobAdded);
+	libtw07_lock_unlock(&pPool->m_Lock);
+	return 0;
+}
+
+// blocks until the job is done, the calling thread runs pending jobs meanwhile
+int libtw07_jobpool_wait(libtw07_jobPool *pPool, libtw07_job *pJob)
+{
+	libtw07_lock_wait(&pPool->m_Lock);
+	while(libtw07_job_status(pJob) != LIBTW07_JOB_STATE_DONE)
+	{
+		libtw07_job *pPending = _libtw07_jobpool_pop(pPool);
+		if(pPending)
+			_libtw07_jobpool_run(pPool, pPending);
+		else
+			libtw07_cond_wait(&pPool->m_JobDone, &pPool->m_Lock);
+	}
+	libtw07_lock_unlock(&pPool->m_Lock);
+	return libtw07_job_result(pJob);
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // LIBTW07_JOBS_H
@@ -25,8 +25,25 @@
  *
  * Note: This is an altered version — a C language port of the original C++ implementation.
  */
+#ifndef LIBTW07_MAP_H
+#define LIBTW07_MAP_H
+
 #include "datafile.h"
 
+// wide stores for filling tile runs, LIBTW07_MAP_NO_SIMD keeps the plain loop
+#if !defined(LIBTW07_MAP_NO_SIMD)
+	#if defined(__AVX2__)
+		#include <immintrin.h>
+		#define LIBTW07_MAP_TILES_AVX2 1
+	#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+		#include <emmintrin.h>
+		#define LIBTW07_MAP_TILES_SSE2 1
+	#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+		#include <arm_neon.h>
+		#define LIBTW07_MAP_TILES_NEON 1
+	#endif
+#endif
+
 typedef libtw07_datafileReader libtw07_map_reader;
 
 // layer types
@@ -321,64 +338,260 @@ void libtw07_intsToStr(const int *pInts, int Num, char *pStr)
 
 int libtw07_map_reader_open(libtw07_map_reader *pMap, const char *pMapPath)
 {
-    if(!libtw07_datafile_reader_open(pMap, pMapPath))
+    if(libtw07_datafile_reader_open(pMap, pMapPath) != 0)
         return -1;
     // check version
     libtw07_map_itemVersion *pItem = (libtw07_map_itemVersion *) libtw07_datafile_reader_findItem(pMap, LIBTW07_MAPITEMTYPE_VERSION, 0);
     if(!pItem || pItem->m_Version != LIBTW07_MAP_ITEMVERSION_CURRENT_VERSION)
         return -1;
 
-    // replace compressed tile layers with uncompressed ones
-    int GroupsStart, GroupsNum, LayersStart, LayersNum;
-    libtw07_datafile_reader_getType(pMap, LIBTW07_MAPITEMTYPE_GROUP, &GroupsStart, &GroupsNum);
-    libtw07_datafile_reader_getType(pMap, LIBTW07_MAPITEMTYPE_LAYER, &LayersStart, &LayersNum);
-    for(int g = 0; g < GroupsNum; g++)
-    {
-        libtw07_map_itemGroup *pGroup = (libtw07_map_itemGroup *) libtw07_datafile_reader_getItem(pMap, GroupsStart + g, 0, 0);
-        for(int l = 0; l < pGroup->m_NumLayers; l++)
-        {
-            libtw07_map_itemLayer *pLayer = (libtw07_map_itemLayer *) libtw07_datafile_reader_getItem(pMap, LayersStart + pGroup->m_StartLayer + l, 0, 0);
-            if(pLayer->m_Type == LIBTW07_LAYERTYPE_TILES)
-            {
-                libtw07_map_itemLayerTilemap *pTilemap = (libtw07_map_itemLayerTilemap *) pLayer;
-
-                if(pTilemap->m_Version > 3)
-                {
-                    const int TilemapCount = pTilemap->m_Width * pTilemap->m_Height;
-                    const int TilemapSize = TilemapCount * sizeof(libtw07_map_tile);
-
-                    if((TilemapCount / pTilemap->m_Width != pTilemap->m_Height) || (TilemapSize / (int) sizeof(libtw07_map_tile) != TilemapCount))
-                    {
-                        libtw07_print("map", "map layer too big (%d * %d * %u causes an integer overflow)", pTilemap->m_Width, pTilemap->m_Height, (unsigned)(sizeof(libtw07_map_tile)));
-                        return -1;
-                    }
-                    libtw07_map_tile *pTiles = (libtw07_map_tile *) malloc(TilemapSize);
-                    if(!pTiles)
-                        return -1;
-
-                    // extract original tile data
-                    int i = 0;
-                    libtw07_map_tile *pSavedTiles = (libtw07_map_tile *) libtw07_datafile_reader_getData(pMap, pTilemap->m_Data);
-                    while(i < TilemapCount)
-                    {
-                        for(unsigned Counter = 0; Counter <= pSavedTiles->m_Skip && i < TilemapCount; Counter++)
-                        {
-                            pTiles[i] = *pSavedTiles;
-                            pTiles[i++].m_Skip = 0;
-                        }
-
-                        pSavedTiles++;
-                    }
-
-                    libtw07_datafile_reader_replaceData(pMap, pTilemap->m_Data, (char *) pTiles, TilemapSize);
-                }
-            }
-        }
-    }
-
+    // tile layers are expanded by libtw07_map_reader_getTiles when they are first used
     return 0;
 }
 
+// sets Num tiles to Tile. with SIMD the last store may go up to a vector past them when Room allows,
+// those tiles are overwritten by the following runs
+void _libtw07_map_fillTiles(libtw07_map_tile *pDst, libtw07_map_tile Tile, int Num, int Room)
+{
+	int i = 0;
+#if defined(LIBTW07_MAP_TILES_AVX2) || defined(LIBTW07_MAP_TILES_SSE2) || defined(LIBTW07_MAP_TILES_NEON)
+	uint32_t Value;
+	memcpy(&Value, &Tile, sizeof(Value));
+#if defined(LIBTW07_MAP_TILES_AVX2)
+	enum { LANES = 8 };
+	__m256i Vec = _mm256_set1_epi32((int)Value);
+	#define _LIBTW07_MAP_STORE_TILES(p) _mm256_storeu_si256((__m256i *)(p), Vec)
+#elif defined(LIBTW07_MAP_TILES_SSE2)
+	enum { LANES = 4 };
+	__m128i Vec = _mm_set1_epi32((int)Value);
+	#define _LIBTW07_MAP_STORE_TILES(p) _mm_storeu_si128((__m128i *)(p), Vec)
+#else
+	enum { LANES = 4 };
+	uint32x4_t Vec = vdupq_n_u32(Value);
+	#define _LIBTW07_MAP_STORE_TILES(p) vst1q_u32((uint32_t *)(p), Vec)
+#endif
+	if(Room >= LANES)
+	{
+		int Rounded = (Num + LANES - 1) & ~(LANES - 1);
+		int End = Rounded <= Room ? Rounded : Num & ~(LANES - 1);
+		for(; i < End; i += LANES)
+			_LIBTW07_MAP_STORE_TILES(pDst + i);
+	}
+	#undef _LIBTW07_MAP_STORE_TILES
+#else
+	(void)Room;
+#endif
+	for(; i < Num; i++)
+		pDst[i] = Tile;
+}
+
+// expands NumSaved tiles where m_Skip tells how often a tile repeats after the first into NumTiles
+// tiles with m_Skip cleared. a run going past the end is cut, returns -1 when the saved tiles end
+// before all tiles are set
+int libtw07_map_expandTiles(libtw07_map_tile *pTiles, int NumTiles, const libtw07_map_tile *pSaved, int NumSaved)
+{
+	int i = 0;
+	int s = 0;
+	while(i < NumTiles)
+	{
+		if(s >= NumSaved)
+		{
+			libtw07_print("map", "tile data ends after %d of %d tiles", i, NumTiles);
+			return -1;
+		}
+
+		libtw07_map_tile Tile = pSaved[s++];
+		int Run = Tile.m_Skip + 1;
+		if(Run > NumTiles - i)
+			Run = NumTiles - i;
+		Tile.m_Skip = 0;
+
+		if(Run == 1)
+			pTiles[i] = Tile;
+		else
+			_libtw07_map_fillTiles(pTiles + i, Tile, Run, NumTiles - i);
+		i += Run;
+	}
+	return 0;
+}
+
+// returns the tilemap of layer item LayerIndex or 0 when it is no tile layer
+libtw07_map_itemLayerTilemap *libtw07_map_reader_getTilemap(libtw07_map_reader *pMap, int LayerIndex)
+{
+	int LayersStart, LayersNum;
+	libtw07_datafile_reader_getType(pMap, LIBTW07_MAPITEMTYPE_LAYER, &LayersStart, &LayersNum);
+	if(LayerIndex < 0 || LayerIndex >= LayersNum)
+		return 0;
+
+	libtw07_map_itemLayer *pLayer = (libtw07_map_itemLayer *) libtw07_datafile_reader_getItem(pMap, LayersStart + LayerIndex, 0, 0);
+	if(!pLayer || pLayer->m_Type != LIBTW07_LAYERTYPE_TILES || libtw07_datafile_reader_getItemSize(pMap, LayersStart + LayerIndex) < (int) sizeof(libtw07_map_itemLayerTilemap) - (int) sizeof(int) * 3)
+		return 0;
+	return (libtw07_map_itemLayerTilemap *) pLayer;
+}
+
+// returns Width * Height or -1 when the layer could not be addressed
+int _libtw07_map_tilemapCount(const libtw07_map_itemLayerTilemap *pTilemap)
+{
+	if(pTilemap->m_Width <= 0 || pTilemap->m_Height <= 0)
+		return -1;
+
+	const int TilemapCount = pTilemap->m_Width * pTilemap->m_Height;
+	const int TilemapSize = TilemapCount * sizeof(libtw07_map_tile);
+	if((TilemapCount / pTilemap->m_Width != pTilemap->m_Height) || (TilemapSize / (int) sizeof(libtw07_map_tile) != TilemapCount))
+	{
+		libtw07_print("map", "map layer too big (%d * %d * %u causes an integer overflow)", pTilemap->m_Width, pTilemap->m_Height, (unsigned)(sizeof(libtw07_map_tile)));
+		return -1;
+	}
+	return TilemapCount;
+}
+
+// returns the Width * Height tiles of layer item LayerIndex. version 4 layers are stored with runs of
+// equal tiles folded into m_Skip, the first call expands them and replaces the data block with the
+// result. that call must not race with other use of the block, later calls only look it up
+libtw07_map_tile *libtw07_map_reader_getTiles(libtw07_map_reader *pMap, int LayerIndex)
+{
+	libtw07_map_itemLayerTilemap *pTilemap = libtw07_map_reader_getTilemap(pMap, LayerIndex);
+	if(!pTilemap)
+		return 0;
+
+	const int TilemapCount = _libtw07_map_tilemapCount(pTilemap);
+	const int TilemapSize = TilemapCount * sizeof(libtw07_map_tile);
+	if(TilemapCount <= 0)
+		return 0;
+
+	if(pTilemap->m_Version <= 3 || libtw07_datafile_reader_isDataReplaced(pMap, pTilemap->m_Data))
+	{
+		libtw07_map_tile *pTiles = (libtw07_map_tile *) libtw07_datafile_reader_getData(pMap, pTilemap->m_Data);
+		if(!pTiles || libtw07_datafile_reader_getDataSize(pMap, pTilemap->m_Data) < TilemapSize)
+			return 0;
+		return pTiles;
+	}
+
+	libtw07_map_tile *pSavedTiles = (libtw07_map_tile *) libtw07_datafile_reader_getData(pMap, pTilemap->m_Data);
+	if(!pSavedTiles)
+		return 0;
+	libtw07_map_tile *pTiles = (libtw07_map_tile *) libtw07_datafile_reader_allocData(pMap, TilemapSize);
+	if(!pTiles)
+		return 0;
+
+	// extract original tile data
+	int NumSaved = libtw07_datafile_reader_getDataSize(pMap, pTilemap->m_Data) / sizeof(libtw07_map_tile);
+	if(libtw07_map_expandTiles(pTiles, TilemapCount, pSavedTiles, NumSaved) != 0)
+	{
+		libtw07_datafile_reader_freeData(pMap, pTiles);
+		return 0;
+	}
+
+	if(libtw07_datafile_reader_replaceData(pMap, pTilemap->m_Data, (char *) pTiles, TilemapSize) != 0)
+	{
+		libtw07_datafile_reader_freeData(pMap, pTiles);
+		return 0;
+	}
+	return pTiles;
+}
+
+struct libtw07_map_tilesTask
+{
+	libtw07_job m_Job;
+	libtw07_map_reader *m_pMap;
+	int m_Data;
+	int m_SavedSize;
+	int m_NumTiles;
+	libtw07_map_tile *m_pTiles;
+};
+typedef struct libtw07_map_tilesTask libtw07_map_tilesTask;
+
+// inflates the saved tiles into a temporary buffer and expands them. apart from the reader's
+// allocator, which has to be thread-safe, it touches nothing shared
+int _libtw07_map_reader_tilesJob(void *pData)
+{
+	libtw07_map_tilesTask *pTask = (libtw07_map_tilesTask *)pData;
+	libtw07_map_tile *pSaved = (libtw07_map_tile *) libtw07_datafile_reader_allocData(pTask->m_pMap, pTask->m_SavedSize + 1);
+	if(!pSaved)
+		return -1;
+
+	int Result = -1;
+	int SavedSize = libtw07_datafile_reader_readDataInto(pTask->m_pMap, pTask->m_Data, pSaved, pTask->m_SavedSize);
+	if(SavedSize >= 0)
+		Result = libtw07_map_expandTiles(pTask->m_pTiles, pTask->m_NumTiles, pSaved, SavedSize / sizeof(libtw07_map_tile));
+	libtw07_datafile_reader_freeData(pTask->m_pMap, pSaved);
+	return Result;
+}
+
+// expands every tile layer that was not expanded yet. each layer is inflated and expanded on the
+// pool and the results are handed to the reader once all are done, without a pool this is the
+// same as calling libtw07_map_reader_getTiles for every layer. returns -1 when a layer failed
+int libtw07_map_reader_loadTiles(libtw07_map_reader *pMap, libtw07_jobPool *pPool)
+{
+	int LayersStart, LayersNum;
+	libtw07_datafile_reader_getType(pMap, LIBTW07_MAPITEMTYPE_LAYER, &LayersStart, &LayersNum);
+
+	int Failed = 0;
+	if(!pPool)
+	{
+		for(int l = 0; l < LayersNum; l++)
+			if(libtw07_map_reader_getTilemap(pMap, l) && !libtw07_map_reader_getTiles(pMap, l))
+				Failed++;
+		return Failed ? -1 : 0;
+	}
+
+	libtw07_map_tilesTask *pTasks = (libtw07_map_tilesTask *) libtw07_datafile_reader_allocData(pMap, LayersNum * sizeof(libtw07_map_tilesTask) + 1);
+	if(!pTasks)
+		return -1;
+
+	int NumTasks = 0;
+	for(int l = 0; l < LayersNum; l++)
+	{
+		libtw07_map_itemLayerTilemap *pTilemap = libtw07_map_reader_getTilemap(pMap, l);
+		if(!pTilemap || pTilemap->m_Version <= 3 || libtw07_datafile_reader_isDataReplaced(pMap, pTilemap->m_Data))
+			continue;
+
+		// layers can share a block, it is expanded once
+		int Queued = 0;
+		for(int i = 0; i < NumTasks && !Queued; i++)
+			Queued = pTasks[i].m_Data == pTilemap->m_Data;
+		if(Queued)
+			continue;
+
+		libtw07_map_tilesTask *pTask = &pTasks[NumTasks];
+		pTask->m_pMap = pMap;
+		pTask->m_Data = pTilemap->m_Data;
+		pTask->m_SavedSize = libtw07_datafile_reader_getDataSize(pMap, pTilemap->m_Data);
+		pTask->m_NumTiles = _libtw07_map_tilemapCount(pTilemap);
+		pTask->m_pTiles = 0;
+		if(pTask->m_NumTiles > 0 && pTask->m_SavedSize > 0)
+			pTask->m_pTiles = (libtw07_map_tile *) libtw07_datafile_reader_allocData(pMap, pTask->m_NumTiles * sizeof(libtw07_map_tile));
+		if(!pTask->m_pTiles)
+		{
+			Failed++;
+			continue;
+		}
+
+		libtw07_jobpool_add(pPool, &pTask->m_Job, _libtw07_map_reader_tilesJob, pTask);
+		NumTasks++;
+	}
+
+	// publish the layers, the reader is only touched from this thread
+	for(int i = 0; i < NumTasks; i++)
+	{
+		libtw07_map_tilesTask *pTask = &pTasks[i];
+		if(libtw07_jobpool_wait(pPool, &pTask->m_Job) != 0)
+		{
+			Failed++;
+			libtw07_datafile_reader_freeData(pMap, pTask->m_pTiles);
+			continue;
+		}
+		if(libtw07_datafile_reader_replaceData(pMap, pTask->m_Data, (char *) pTask->m_pTiles, pTask->m_NumTiles * sizeof(libtw07_map_tile)) != 0)
+		{
+			Failed++;
+			libtw07_datafile_reader_freeData(pMap, pTask->m_pTiles);
+		}
+	}
+
+	libtw07_datafile_reader_freeData(pMap, pTasks);
+	return Failed ? -1 : 0;
+}
+
 void libtw07_map_reader_init(libtw07_map_reader *pMap)
 {
 	libtw07_datafile_reader_init(pMap);
@@ -393,3 +606,294 @@ void libtw07_map_reader_unload(libtw07_map_reader *pMap)
 {
 	return libtw07_datafile_reader_destroy(pMap);
 }
+
+/* writer */
+
+// number of tiles from pTiles[0] on that only differ in m_Skip, at most Max
+int _libtw07_map_tileRun(const libtw07_map_tile *pTiles, int Max)
+{
+	libtw07_map_tile MaskTile = {0xff, 0xff, 0, 0xff};
+	uint32_t Mask, Value;
+	memcpy(&Mask, &MaskTile, sizeof(Mask));
+	memcpy(&Value, pTiles, sizeof(Value));
+	Value &= Mask;
+
+	int i = 1;
+#if defined(LIBTW07_MAP_TILES_AVX2)
+	__m256i VecMask = _mm256_set1_epi32((int)Mask);
+	__m256i Vec = _mm256_set1_epi32((int)Value);
+	for(; i + 8 <= Max; i += 8)
+	{
+		__m256i Cmp = _mm256_cmpeq_epi32(_mm256_and_si256(_mm256_loadu_si256((const __m256i *)(pTiles + i)), VecMask), Vec);
+		int Bits = _mm256_movemask_ps(_mm256_castsi256_ps(Cmp));
+		if(Bits != 0xff)
+			break;
+	}
+#elif defined(LIBTW07_MAP_TILES_SSE2)
+	__m128i VecMask = _mm_set1_epi32((int)Mask);
+	__m128i Vec = _mm_set1_epi32((int)Value);
+	for(; i + 4 <= Max; i += 4)
+	{
+		__m128i Cmp = _mm_cmpeq_epi32(_mm_and_si128(_mm_loadu_si128((const __m128i *)(pTiles + i)), VecMask), Vec);
+		if(_mm_movemask_epi8(Cmp) != 0xffff)
+			break;
+	}
+#elif defined(LIBTW07_MAP_TILES_NEON)
+	uint32x4_t VecMask = vdupq_n_u32(Mask);
+	uint32x4_t Vec = vdupq_n_u32(Value);
+	for(; i + 4 <= Max; i += 4)
+	{
+		uint64x2_t Cmp = vreinterpretq_u64_u32(vceqq_u32(vandq_u32(vld1q_u32((const uint32_t *)(pTiles + i)), VecMask), Vec));
+		if((vgetq_lane_u64(Cmp, 0) & vgetq_lane_u64(Cmp, 1)) != ~(uint64_t)0)
+			break;
+	}
+#endif
+	// the rest, and the exact end of the run within the last vector
+	for(; i < Max; i++)
+	{
+		uint32_t Tile;
+		memcpy(&Tile, pTiles + i, sizeof(Tile));
+		if((Tile & Mask) != Value)
+			break;
+	}
+	return i;
+}
+
+// folds runs of up to 256 tiles that only differ in m_Skip into one tile, the way version 4 tile
+// layers are stored. pSaved needs room for NumTiles tiles, returns the number of saved tiles
+int libtw07_map_compressTiles(libtw07_map_tile *pSaved, const libtw07_map_tile *pTiles, int NumTiles)
+{
+	int NumSaved = 0;
+	for(int i = 0; i < NumTiles;)
+	{
+		int Run = _libtw07_map_tileRun(pTiles + i, libtw07_minimum(NumTiles - i, 256));
+		pSaved[NumSaved] = pTiles[i];
+		pSaved[NumSaved++].m_Skip = Run - 1;
+		i += Run;
+	}
+	return NumSaved;
+}
+
+struct libtw07_map_writer
+{
+	libtw07_datafileWriter m_Writer; // can be set up with compression, a job pool and so on
+
+	// groups and envelope points are written by finish, when all layers and envelopes are known
+	libtw07_map_itemGroup *m_pGroups;
+	int m_NumGroups;
+	int m_GroupsCapacity;
+	libtw07_map_envPoint *m_pEnvPoints;
+	int m_NumEnvPoints;
+	int m_EnvPointsCapacity;
+
+	int m_NumImages;
+	int m_NumEnvelopes;
+	int m_NumLayers;
+};
+typedef struct libtw07_map_writer libtw07_map_writer;
+
+void libtw07_map_writer_init(libtw07_map_writer *pMap)
+{
+	libtw07_datafile_writer_init(&pMap->m_Writer);
+	pMap->m_pGroups = 0;
+	pMap->m_NumGroups = 0;
+	pMap->m_GroupsCapacity = 0;
+	pMap->m_pEnvPoints = 0;
+	pMap->m_NumEnvPoints = 0;
+	pMap->m_EnvPointsCapacity = 0;
+	pMap->m_NumImages = 0;
+	pMap->m_NumEnvelopes = 0;
+	pMap->m_NumLayers = 0;
+}
+
+void libtw07_map_writer_destroy(libtw07_map_writer *pMap)
+{
+	libtw07_datafile_writer_destroy(&pMap->m_Writer);
+	free(pMap->m_pGroups);
+	free(pMap->m_pEnvPoints);
+	libtw07_map_writer_init(pMap);
+}
+
+int _libtw07_map_writer_start(libtw07_map_writer *pMap)
+{
+	pMap->m_NumGroups = 0;
+	pMap->m_NumEnvPoints = 0;
+	pMap->m_NumImages = 0;
+	pMap->m_NumEnvelopes = 0;
+	pMap->m_NumLayers = 0;
+
+	libtw07_map_itemVersion Version;
+	Version.m_Version = LIBTW07_MAP_ITEMVERSION_CURRENT_VERSION;
+	return libtw07_datafile_writer_addItem(&pMap->m_Writer, LIBTW07_MAPITEMTYPE_VERSION, 0, sizeof(Version), &Version) < 0 ? -1 : 0;
+}
+
+int libtw07_map_writer_open(libtw07_map_writer *pMap, const char *pFilename)
+{
+	if(libtw07_datafile_writer_open(&pMap->m_Writer, pFilename) != 0)
+		return -1;
+	return _libtw07_map_writer_start(pMap);
+}
+
+// the finished map is taken with libtw07_datafile_writer_takeMemory(&pMap->m_Writer, ...)
+int libtw07_map_writer_openMemory(libtw07_map_writer *pMap)
+{
+	if(libtw07_datafile_writer_openMemory(&pMap->m_Writer) != 0)
+		return -1;
+	return _libtw07_map_writer_start(pMap);
+}
+
+// returns the data index of the string or -1 when there is none
+int _libtw07_map_writer_addString(libtw07_map_writer *pMap, const char *pStr)
+{
+	if(!pStr)
+		return -1;
+	return libtw07_datafile_writer_addData(&pMap->m_Writer, strlen(pStr) + 1, pStr);
+}
+
+// any of the strings can be 0, returns 0 or -1 when the info could not be added
+int libtw07_map_writer_setInfo(libtw07_map_writer *pMap, const char *pAuthor, const char *pMapVersion, const char *pCredits, const char *pLicense)
+{
+	libtw07_map_itemInfo Info;
+	Info.m_Version = LIBTW07_MAP_ITEMINFO_CURRENT_VERSION;
+	Info.m_Author = _libtw07_map_writer_addString(pMap, pAuthor);
+	Info.m_MapVersion = _libtw07_map_writer_addString(pMap, pMapVersion);
+	Info.m_Credits = _libtw07_map_writer_addString(pMap, pCredits);
+	Info.m_License = _libtw07_map_writer_addString(pMap, pLicense);
+	return libtw07_datafile_writer_addItem(&pMap->m_Writer, LIBTW07_MAPITEMTYPE_INFO, 0, sizeof(Info), &Info) < 0 ? -1 : 0;
+}
+
+// pRGBA holds Width * Height pixels or is 0 for an external image, returns the image index or -1
+int libtw07_map_writer_addImage(libtw07_map_writer *pMap, const char *pName, int Width, int Height, const void *pRGBA)
+{
+	if(Width <= 0 || Height <= 0 || (int64_t)Width * Height * 4 > 0x7fffffff)
+	{
+		libtw07_print("map", "invalid image size %d * %d", Width, Height);
+		return -1;
+	}
+
+	libtw07_map_itemImage Image;
+	Image.m_Version = LIBTW07_MAP_ITEMIMAGE_CURRENT_VERSION;
+	Image.m_Width = Width;
+	Image.m_Height = Height;
+	Image.m_External = pRGBA == 0;
+	Image.m_ImageName = _libtw07_map_writer_addString(pMap, pName);
+	Image.m_ImageData = pRGBA ? libtw07_datafile_writer_addData(&pMap->m_Writer, Width * Height * 4, pRGBA) : -1;
+	if(pRGBA && Image.m_ImageData < 0)
+		return -1;
+	Image.m_MustBe1 = 1;
+	if(libtw07_datafile_writer_addItem(&pMap->m_Writer, LIBTW07_MAPITEMTYPE_IMAGE, pMap->m_NumImages, sizeof(Image), &Image) < 0)
+		return -1;
+	return pMap->m_NumImages++;
+}
+
+// the points are copied, returns the envelope index or -1
+int libtw07_map_writer_addEnvelope(libtw07_map_writer *pMap, const char *pName, int Channels, int Synchronized, const libtw07_map_envPoint *pPoints, int NumPoints)
+{
+	if(NumPoints < 0 || (NumPoints > 0 && !pPoints))
+	{
+		libtw07_print("map", "invalid envelope points, num=%d", NumPoints);
+		return -1;
+	}
+	if(_libtw07_datafile_writer_grow(&pMap->m_pEnvPoints, &pMap->m_EnvPointsCapacity, pMap->m_NumEnvPoints + NumPoints, sizeof(libtw07_map_envPoint)) != 0)
+		return -1;
+	if(NumPoints)
+		memcpy(pMap->m_pEnvPoints + pMap->m_NumEnvPoints, pPoints, NumPoints * sizeof(libtw07_map_envPoint));
+
+	libtw07_map_itemEnvelope Envelope;
+	Envelope.m_Version = LIBTW07_MAP_ITEMENVELOPE_CURRENT_VERSION;
+	Envelope.m_Channels = Channels;
+	Envelope.m_StartPoint = pMap->m_NumEnvPoints;
+	Envelope.m_NumPoints = NumPoints;
+	libtw07_strToInts(Envelope.m_aName, sizeof(Envelope.m_aName) / sizeof(int), pName ? pName : "");
+	Envelope.m_Synchronized = Synchronized;
+	if(libtw07_datafile_writer_addItem(&pMap->m_Writer, LIBTW07_MAPITEMTYPE_ENVELOPE, pMap->m_NumEnvelopes, sizeof(Envelope), &Envelope) < 0)
+		return -1;
+
+	pMap->m_NumEnvPoints += NumPoints;
+	return pMap->m_NumEnvelopes++;
+}
+
+// starts a group, the layers added after it belong to it. m_StartLayer and m_NumLayers are
+// filled in by the writer, returns the group index
+int libtw07_map_writer_addGroup(libtw07_map_writer *pMap, const libtw07_map_itemGroup *pGroup)
+{
+	if(_libtw07_datafile_writer_grow(&pMap->m_pGroups, &pMap->m_GroupsCapacity, pMap->m_NumGroups + 1, sizeof(libtw07_map_itemGroup)) != 0)
+		return -1;
+
+	libtw07_map_itemGroup *pItem = &pMap->m_pGroups[pMap->m_NumGroups];
+	*pItem = *pGroup;
+	pItem->m_Version = LIBTW07_MAP_ITEMGROUP_CURRENT_VERSION;
+	pItem->m_StartLayer = pMap->m_NumLayers;
+	pItem->m_NumLayers = 0;
+	return pMap->m_NumGroups++;
+}
+
+int _libtw07_map_writer_addLayer(libtw07_map_writer *pMap, int Size, const void *pLayer)
+{
+	libtw07_dbg_assert(pMap->m_NumGroups > 0, "layers have to be added to a group");
+	if(libtw07_datafile_writer_addItem(&pMap->m_Writer, LIBTW07_MAPITEMTYPE_LAYER, pMap->m_NumLayers, Size, pLayer) < 0)
+		return -1;
+	pMap->m_pGroups[pMap->m_NumGroups - 1].m_NumLayers++;
+	return pMap->m_NumLayers++;
+}
+
+// adds Width * Height tiles to the current group, they are stored run length encoded.
+// m_Data and the versions are filled in by the writer, returns the layer index
+int libtw07_map_writer_addTileLayer(libtw07_map_writer *pMap, const libtw07_map_itemLayerTilemap *pLayer, const libtw07_map_tile *pTiles)
+{
+	int NumTiles = _libtw07_map_tilemapCount(pLayer);
+	if(NumTiles <= 0)
+		return -1;
+
+	libtw07_map_tile *pSaved = (libtw07_map_tile *) malloc(NumTiles * sizeof(libtw07_map_tile));
+	if(!pSaved)
+		return -1;
+	int NumSaved = libtw07_map_compressTiles(pSaved, pTiles, NumTiles);
+
+	// the buffer lives until the block is compressed, which may be later with a job pool
+	libtw07_map_tile *pShrunk = (libtw07_map_tile *) realloc(pSaved, NumSaved * sizeof(libtw07_map_tile));
+	if(pShrunk)
+		pSaved = pShrunk;
+
+	libtw07_map_itemLayerTilemap Item = *pLayer;
+	Item.m_Layer.m_Version = 0;
+	Item.m_Layer.m_Type = LIBTW07_LAYERTYPE_TILES;
+	Item.m_Version = LIBTW07_MAP_ITEMLAYERTILEMAP_CURRENT_VERSION;
+	Item.m_Data = libtw07_datafile_writer_addDataEx(&pMap->m_Writer, NumSaved * sizeof(libtw07_map_tile), pSaved, pMap->m_Writer.m_Level, pMap->m_Writer.m_Strategy, LIBTW07_DATAFILE_BUFFER_TAKE);
+	if(Item.m_Data < 0)
+	{
+		free(pSaved);
+		return -1;
+	}
+	return _libtw07_map_writer_addLayer(pMap, sizeof(Item), &Item);
+}
+
+// adds NumQuads quads to the current group, m_Data and the versions are filled in by the writer.
+// returns the layer index
+int libtw07_map_writer_addQuadsLayer(libtw07_map_writer *pMap, const libtw07_map_itemLayerQuads *pLayer, const libtw07_map_quad *pQuads)
+{
+	libtw07_map_itemLayerQuads Item = *pLayer;
+	Item.m_Layer.m_Version = 0;
+	Item.m_Layer.m_Type = LIBTW07_LAYERTYPE_QUADS;
+	Item.m_Version = LIBTW07_MAP_ITEMLAYERQUADS_CURRENT_VERSION;
+	Item.m_Data = libtw07_datafile_writer_addDataSwapped(&pMap->m_Writer, Item.m_NumQuads * sizeof(libtw07_map_quad), pQuads);
+	if(Item.m_Data < 0)
+		return -1;
+	return _libtw07_map_writer_addLayer(pMap, sizeof(Item), &Item);
+}
+
+// writes the groups and envelope points and finishes the file, returns 1 on success like the datafile writer.
+// on failure the unfinished file is dropped by libtw07_map_writer_destroy
+int libtw07_map_writer_finish(libtw07_map_writer *pMap)
+{
+	for(int g = 0; g < pMap->m_NumGroups; g++)
+	{
+		if(libtw07_datafile_writer_addItem(&pMap->m_Writer, LIBTW07_MAPITEMTYPE_GROUP, g, sizeof(libtw07_map_itemGroup), &pMap->m_pGroups[g]) < 0)
+			return 0;
+	}
+	if(pMap->m_NumEnvPoints && libtw07_datafile_writer_addItem(&pMap->m_Writer, LIBTW07_MAPITEMTYPE_ENVPOINTS, 0, pMap->m_NumEnvPoints * sizeof(libtw07_map_envPoint), pMap->m_pEnvPoints) < 0)
+		return 0;
+	return libtw07_datafile_writer_finish(&pMap->m_Writer);
+}
+
+#endif // LIBTW07_MAP_H
@@ -0,0 +1,288 @@
+/*
+ * This file is part of libtw07, a header-only library for teeworlds0.7.
+ *
+ * Orignal Code by:
+ * Copyright (C) 2007-2025 Magnus Auvinen
+ *
+ * Libtw07 Library:
+ * Copyright (C) 2025 TeeworldsArchive
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty. In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ *
+ * Note: This is an altered version — a C language port of the original C++ implementation.
+ */
+#ifndef LIBTW07_THREAD_H
+#define LIBTW07_THREAD_H
+
+#include <stdlib.h>
+
+#include "detect.h"
+
+#if defined(CONF_FAMILY_WINDOWS)
+	#define WIN32_LEAN_AND_MEAN
+	#include <windows.h>
+#else
+	#include <pthread.h>
+	#include <sched.h>
+	#include <unistd.h>
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* threads */
+
+struct libtw07_threadData
+{
+	void (*m_pfnFunc)(void *);
+	void *m_pUser;
+};
+typedef struct libtw07_threadData libtw07_threadData;
+
+#if defined(CONF_FAMILY_WINDOWS)
+DWORD WINAPI _libtw07_thread_run(LPVOID pData)
+{
+	libtw07_threadData Data = *(libtw07_threadData *)pData;
+	free(pData);
+	Data.m_pfnFunc(Data.m_pUser);
+	return 0;
+}
+#else
+void *_libtw07_thread_run(void *pData)
+{
+	libtw07_threadData Data = *(libtw07_threadData *)pData;
+	free(pData);
+	Data.m_pfnFunc(Data.m_pUser);
+	return 0;
+}
+#endif
+
+// starts a thread running threadfunc(user), returns 0 on failure
+void *libtw07_thread_init(void (*threadfunc)(void *), void *user)
+{
+	libtw07_threadData *pData = (libtw07_threadData *) malloc(sizeof(libtw07_threadData));
+	if(!pData)
+		return 0;
+	pData->m_pfnFunc = threadfunc;
+	pData->m_pUser = user;
+
+#if defined(CONF_FAMILY_WINDOWS)
+	HANDLE Thread = CreateThread(NULL, 0, _libtw07_thread_run, pData, 0, NULL);
+	if(!Thread)
+	{
+		free(pData);
+		return 0;
+	}
+	return (void *)Thread;
+#else
+	pthread_t *pThread = (pthread_t *) malloc(sizeof(pthread_t));
+	if(!pThread || pthread_create(pThread, NULL, _libtw07_thread_run, pData) != 0)
+	{
+		free(pThread);
+		free(pData);
+		return 0;
+	}
+	return pThread;
+#endif
+}
+
+void libtw07_thread_wait(void *thread)
+{
+#if defined(CONF_FAMILY_WINDOWS)
+	WaitForSingleObject((HANDLE)thread, INFINITE);
+	CloseHandle((HANDLE)thread);
+#else
+	pthread_join(*(pthread_t *)thread, NULL);
+	free(thread);
+#endif
+}
+
+void libtw07_thread_yield()
+{
+#if defined(CONF_FAMILY_WINDOWS)
+	Sleep(0);
+#else
+	sched_yield();
+#endif
+}
+
+int libtw07_cpu_count()
+{
+#if defined(CONF_FAMILY_WINDOWS)
+	SYSTEM_INFO Info;
+	GetSystemInfo(&Info);
+	return Info.dwNumberOfProcessors > 0 ? (int)Info.dwNumberOfProcessors : 1;
+#elif defined(_SC_NPROCESSORS_ONLN)
+	long Count = sysconf(_SC_NPROCESSORS_ONLN);
+	return Count > 0 ? (int)Count : 1;
+#else
+	return 1;
+#endif
+}
+
+/* locks */
+
+struct libtw07_lock
+{
+#if defined(CONF_FAMILY_WINDOWS)
+	CRITICAL_SECTION m_Section;
+#else
+	pthread_mutex_t m_Mutex;
+#endif
+};
+typedef struct libtw07_lock libtw07_lock;
+
+void libtw07_lock_init(libtw07_lock *pLock)
+{
+#if defined(CONF_FAMILY_WINDOWS)
+	InitializeCriticalSection(&pLock->m_Section);
+#else
+	pthread_mutex_init(&pLock->m_Mutex, NULL);
+#endif
+}
+
+void libtw07_lock_destroy(libtw07_lock *pLock)
+{
+#if defined(CONF_FAMILY_WINDOWS)
+	DeleteCriticalSection(&pLock->m_Section);
+#else
+	pthread_mutex_destroy(&pLock->m_Mutex);
+#endif
+}
+
+void libtw07_lock_wait(libtw07_lock *pLock)
+{
+#if defined(CONF_FAMILY_WINDOWS)
+	EnterCriticalSection(&pLock->m_Section);
+#else
+	pthread_mutex_lock(&pLock->m_Mutex);
+#endif
+}
+
+void libtw07_lock_unlock(libtw07_lock *pLock)
+{
+#if defined(CONF_FAMILY_WINDOWS)
+	LeaveCriticalSection(&pLock->m_Section);
+#else
+	pthread_mutex_unlock(&pLock->m_Mutex);
+#endif
+}
+
+/* condition variables, always used together with a lock */
+
+struct libtw07_cond
+{
+#if defined(CONF_FAMILY_WINDOWS)
+	CONDITION_VARIABLE m_Cond;
+#else
+	pthread_cond_t m_Cond;
+#endif
+};
+typedef struct libtw07_cond libtw07_cond;
+
+void libtw07_cond_init(libtw07_cond *pCond)
+{
+#if defined(CONF_FAMILY_WINDOWS)
+	InitializeConditionVariable(&pCond->m_Cond);
+#else
+	pthread_cond_init(&pCond->m_Cond, NULL);
+#endif
+}
+
+void libtw07_cond_destroy(libtw07_cond *pCond)
+{
+#if defined(CONF_FAMILY_WINDOWS)
+	(void)pCond;
+#else
+	pthread_cond_destroy(&pCond->m_Cond);
+#endif
+}
+
+// releases the lock while waiting, it is held again when this returns
+void libtw07_cond_wait(libtw07_cond *pCond, libtw07_lock *pLock)
+{
+#if defined(CONF_FAMILY_WINDOWS)
+	SleepConditionVariableCS(&pCond->m_Cond, &pLock->m_Section, INFINITE);
+#else
+	pthread_cond_wait(&pCond->m_Cond, &pLock->m_Mutex);
+#endif
+}
+
+void libtw07_cond_signal(libtw07_cond *pCond)
+{
+#if defined(CONF_FAMILY_WINDOWS)
+	WakeConditionVariable(&pCond->m_Cond);
+#else
+	pthread_cond_signal(&pCond->m_Cond);
+#endif
+}
+
+void libtw07_cond_broadcast(libtw07_cond *pCond)
+{
+#if defined(CONF_FAMILY_WINDOWS)
+	WakeAllConditionVariable(&pCond->m_Cond);
+#else
+	pthread_cond_broadcast(&pCond->m_Cond);
+#endif
+}
+
+/* atomics, all of them are sequentially consistent */
+
+int libtw07_atomic_load(volatile int *pValue)
+{
+#if defined(CONF_FAMILY_WINDOWS) && !defined(__GNUC__)
+	return InterlockedCompareExchange((volatile LONG *)pValue, 0, 0);
+#else
+	return __atomic_load_n(pValue, __ATOMIC_SEQ_CST);
+#endif
+}
+
+void libtw07_atomic_store(volatile int *pValue, int Value)
+{
+#if defined(CONF_FAMILY_WINDOWS) && !defined(__GNUC__)
+	InterlockedExchange((volatile LONG *)pValue, Value);
+#else
+	__atomic_store_n(pValue, Value, __ATOMIC_SEQ_CST);
+#endif
+}
+
+// returns the new value
+int libtw07_atomic_add(volatile int *pValue, int Amount)
+{
+#if defined(CONF_FAMILY_WINDOWS) && !defined(__GNUC__)
+	return InterlockedExchangeAdd((volatile LONG *)pValue, Amount) + Amount;
+#else
+	return __atomic_add_fetch(pValue, Amount, __ATOMIC_SEQ_CST);
+#endif
+}
+
+// sets *pValue to Desired if it is Expected, returns whether it did
+int libtw07_atomic_cas(volatile int *pValue, int Expected, int Desired)
+{
+#if defined(CONF_FAMILY_WINDOWS) && !defined(__GNUC__)
+	return InterlockedCompareExchange((volatile LONG *)pValue, Desired, Expected) == Expected;
+#else
+	return __atomic_compare_exchange_n(pValue, &Expected, Desired, 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+#endif
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // LIBTW07_THREAD_H
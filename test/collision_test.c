@@ -0,0 +1,76 @@
+/*
+ * This file is part of libtw07, a header-only library for teeworlds0.7.
+ *
+ * Copyright (C) 2025 TeeworldsArchive
+ * 
+ * This software is provided 'as-is', without any express or implied
+ * warranty. In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ *
+ */
+// map.h comes first on purpose, collision.h includes it again
+#include "../lib/map.h"
+#include "../lib/collision.h"
+
+#include <math.h>
+
+enum
+{
+    WIDTH = 8,
+    HEIGHT = 4,
+    BORDER = 2,
+};
+
+int main(int argc, const char **argv)
+{
+    // a solid floor and a nohook tile in the corner
+    libtw07_map_tile aTiles[WIDTH * HEIGHT];
+    memset(aTiles, 0, sizeof(aTiles));
+    for(int x = 0; x < WIDTH; x++)
+        aTiles[(HEIGHT - 1) * WIDTH + x].m_Index = LIBTW07_TILE_SOLID;
+    aTiles[WIDTH - 1].m_Index = LIBTW07_TILE_NOHOOK;
+
+    libtw07_collision Collision;
+    if(libtw07_collision_initFromTiles(&Collision, aTiles, WIDTH, HEIGHT, BORDER) != 0)
+        return -1;
+    for(int y = -BORDER; y < HEIGHT + BORDER; y++)
+        for(int x = -BORDER; x < WIDTH + BORDER; x++)
+        {
+            int Index = aTiles[libtw07_clamp(y, 0, HEIGHT - 1) * WIDTH + libtw07_clamp(x, 0, WIDTH - 1)].m_Index;
+            if(libtw07_collision_getTile(&Collision, x, y) != Index)
+                return -1;
+        }
+    printf("map.h and collision.h build together\n");
+
+    // world positions far off the map, infinities and NaN see the tile at the nearest edge
+    static const float s_aFar[] = {-1e30f, -100000.0f, -(BORDER + 1) * 32.0f, (WIDTH + BORDER + 1) * 32.0f, 100000.0f, 1e30f, INFINITY, -INFINITY, NAN};
+    int NumFar = sizeof(s_aFar) / sizeof(s_aFar[0]);
+    for(int i = 0; i < NumFar; i++)
+    {
+        float Far = s_aFar[i];
+        int Right = Far > 0.0f;
+        // below the map is the floor, above it the air or the nohook corner
+        if(!libtw07_collision_checkPoint(&Collision, Far, (HEIGHT + 50) * 32.0f))
+            return -1;
+        if(libtw07_collision_getAt(&Collision, Far, -50 * 32.0f) != (Right ? LIBTW07_TILE_NOHOOK : LIBTW07_TILE_AIR))
+            return -1;
+        if(libtw07_collision_getAt(&Collision, 3 * 32.0f, Far) != (Far > 0.0f ? LIBTW07_TILE_SOLID : LIBTW07_TILE_AIR))
+            return -1;
+    }
+    printf("%d positions off the map see the nearest edge\n", NumFar);
+
+    libtw07_collision_destroy(&Collision);
+    return 0;
+}
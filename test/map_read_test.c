@@ -68,6 +68,10 @@ int main(int argc, const char **argv)
                 if(!aLayerName[0])
                     strncpy(aLayerName, "(unnamed)", sizeof(aLayerName));
                 libtw07_print("test", "| %stilemap layer: %s", (pTilemap->m_Flags&LIBTW07_TILESLAYERFLAG_GAME ? "game " : ""), aLayerName);
+
+                if(!libtw07_map_reader_getTiles(&Reader, pGroup->m_StartLayer + l))
+                    return -1;
+                libtw07_print("test", "|   %d x %d tiles", pTilemap->m_Width, pTilemap->m_Height);
             }
             else if(pLayer->m_Type == LIBTW07_LAYERTYPE_QUADS)
             {
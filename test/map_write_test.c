@@ -0,0 +1,236 @@
+/*
+ * This file is part of libtw07, a header-only library for teeworlds0.7.
+ *
+ * Copyright (C) 2025 TeeworldsArchive
+ * 
+ * This software is provided 'as-is', without any express or implied
+ * warranty. In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ *
+ */
+#include "../lib/collision.h"
+
+enum
+{
+    WIDTH = 100,
+    HEIGHT = 50,
+
+    // rows whose runs are longer than the 256 tiles one saved tile can hold
+    RUN_WIDTH = 600,
+    MIXED_WIDTH = 255 + 256 + 257 + 1 + 513,
+};
+
+// lengths of the runs in the mixed row, they end just before, on and past the 256 tile limit
+static const int s_aMixedRuns[] = {255, 256, 257, 1, 513};
+
+// the job pool allocates through it from its threads, so the counters are atomic
+static volatile int s_NumAllocs = 0;
+static volatile int s_NumLive = 0;
+
+static void *CountingAlloc(void *pUser, size_t Size)
+{
+    (void)pUser;
+    libtw07_atomic_add(&s_NumAllocs, 1);
+    libtw07_atomic_add(&s_NumLive, 1);
+    return malloc(Size);
+}
+
+static void CountingFree(void *pUser, void *pPtr)
+{
+    (void)pUser;
+    if(pPtr)
+        libtw07_atomic_add(&s_NumLive, -1);
+    free(pPtr);
+}
+
+int main(int argc, const char **argv)
+{
+    libtw07_enable_print = 1;
+
+    // a floor, two walls and some entities
+    libtw07_map_tile aTiles[WIDTH * HEIGHT];
+    memset(aTiles, 0, sizeof(aTiles));
+    for(int x = 0; x < WIDTH; x++)
+        aTiles[(HEIGHT - 1) * WIDTH + x].m_Index = LIBTW07_TILE_SOLID;
+    for(int y = 0; y < HEIGHT; y++)
+    {
+        aTiles[y * WIDTH].m_Index = LIBTW07_TILE_SOLID;
+        aTiles[y * WIDTH + WIDTH - 1].m_Index = LIBTW07_TILE_NOHOOK;
+    }
+    aTiles[(HEIGHT - 2) * WIDTH + 10].m_Index = LIBTW07_ENTITY_OFFSET + LIBTW07_ENTITY_SPAWN;
+    aTiles[(HEIGHT - 2) * WIDTH + 20].m_Index = LIBTW07_ENTITY_OFFSET + LIBTW07_ENTITY_HEALTH;
+
+    libtw07_map_writer Writer;
+    libtw07_map_writer_init(&Writer);
+    if(libtw07_map_writer_open(&Writer, "map_test.map") != 0)
+        return -1;
+    if(libtw07_map_writer_setInfo(&Writer, "libtw07", "1.0", 0, 0) != 0)
+        return -1;
+    if(libtw07_map_writer_addImage(&Writer, "grass_main", 1024, 1024, 0) != 0)
+        return -1;
+    if(libtw07_map_writer_addImage(&Writer, "empty", 0, 16, 0) != -1 || libtw07_map_writer_addImage(&Writer, "huge", 65536, 65536, 0) != -1)
+        return -1;
+
+    libtw07_map_envPoint aPoints[2];
+    memset(aPoints, 0, sizeof(aPoints));
+    aPoints[1].m_Time = 1000;
+    aPoints[1].m_Curvetype = LIBTW07_CURVETYPE_LINEAR;
+    aPoints[1].m_aValues[0] = 1 << 10; // 1.0 in 22.10 fixed point
+    if(libtw07_map_writer_addEnvelope(&Writer, "bad", 4, 0, aPoints, -1) != -1 || libtw07_map_writer_addEnvelope(&Writer, "bad", 4, 0, 0, 2) != -1)
+        return -1;
+    if(libtw07_map_writer_addEnvelope(&Writer, "fade", 4, 0, aPoints, 2) != 0)
+        return -1;
+
+    libtw07_map_itemGroup Group;
+    memset(&Group, 0, sizeof(Group));
+    Group.m_ParallaxX = 100;
+    Group.m_ParallaxY = 100;
+    libtw07_strToInts(Group.m_aName, 3, "Game");
+    libtw07_map_writer_addGroup(&Writer, &Group);
+
+    libtw07_map_itemLayerTilemap Layer;
+    memset(&Layer, 0, sizeof(Layer));
+    Layer.m_Width = WIDTH;
+    Layer.m_Height = HEIGHT;
+    Layer.m_Flags = LIBTW07_TILESLAYERFLAG_GAME;
+    Layer.m_Color.r = Layer.m_Color.g = Layer.m_Color.b = Layer.m_Color.a = 255;
+    Layer.m_ColorEnv = -1;
+    Layer.m_Image = -1;
+    libtw07_strToInts(Layer.m_aName, 3, "Game");
+    int GameLayer = libtw07_map_writer_addTileLayer(&Writer, &Layer, aTiles);
+
+    libtw07_map_quad Quad;
+    memset(&Quad, 0, sizeof(Quad));
+    Quad.m_PosEnv = -1;
+    Quad.m_ColorEnv = 0;
+    libtw07_map_itemLayerQuads Quads;
+    memset(&Quads, 0, sizeof(Quads));
+    Quads.m_NumQuads = 1;
+    Quads.m_Image = 0;
+    if(libtw07_map_writer_addQuadsLayer(&Writer, &Quads, &Quad) != 1)
+        return -1;
+
+    // one long run of the same tile and a row of runs around the 256 tile limit
+    static libtw07_map_tile s_aRunTiles[RUN_WIDTH];
+    for(int x = 0; x < RUN_WIDTH; x++)
+        s_aRunTiles[x].m_Index = 5;
+    static libtw07_map_tile s_aMixedTiles[MIXED_WIDTH];
+    for(int r = 0, x = 0; r < (int)(sizeof(s_aMixedRuns) / sizeof(s_aMixedRuns[0])); r++)
+        for(int i = 0; i < s_aMixedRuns[r]; i++, x++)
+        {
+            s_aMixedTiles[x].m_Index = r % 2 ? 1 : 3;
+            s_aMixedTiles[x].m_Flags = r == 4 ? LIBTW07_TILEFLAG_VFLIP : 0;
+        }
+    libtw07_map_itemLayerTilemap RowLayer = Layer;
+    RowLayer.m_Flags = 0;
+    RowLayer.m_Height = 1;
+    RowLayer.m_Width = RUN_WIDTH;
+    int RunLayer = libtw07_map_writer_addTileLayer(&Writer, &RowLayer, s_aRunTiles);
+    RowLayer.m_Width = MIXED_WIDTH;
+    int MixedLayer = libtw07_map_writer_addTileLayer(&Writer, &RowLayer, s_aMixedTiles);
+    if(RunLayer != 2 || MixedLayer != 3)
+        return -1;
+
+    if(!libtw07_map_writer_finish(&Writer))
+        return -1;
+    libtw07_map_writer_destroy(&Writer);
+
+    // read it back
+    libtw07_map_reader Reader;
+    libtw07_map_reader_init(&Reader);
+    if(libtw07_map_reader_open(&Reader, "map_test.map") != 0)
+        return -1;
+
+    libtw07_map_itemLayerTilemap *pTilemap = libtw07_map_reader_getTilemap(&Reader, GameLayer);
+    if(!pTilemap)
+        return -1;
+    int NumSaved = libtw07_datafile_reader_getDataSize(&Reader, pTilemap->m_Data) / (int) sizeof(libtw07_map_tile);
+    libtw07_map_tile *pTiles = libtw07_map_reader_getTiles(&Reader, GameLayer);
+    if(!pTiles || memcmp(pTiles, aTiles, sizeof(aTiles)) != 0)
+        return -1;
+    libtw07_print("test", "game layer %d x %d stored in %d tiles", pTilemap->m_Width, pTilemap->m_Height, NumSaved);
+
+    int Start, Num;
+    libtw07_datafile_reader_getType(&Reader, LIBTW07_MAPITEMTYPE_GROUP, &Start, &Num);
+    libtw07_map_itemGroup *pGroup = (libtw07_map_itemGroup *) libtw07_datafile_reader_getItem(&Reader, Start, 0, 0);
+    if(Num != 1 || pGroup->m_StartLayer != 0 || pGroup->m_NumLayers != 4)
+        return -1;
+
+    // a run is split every 256 tiles, 600 tiles take 3 and the mixed runs 1 + 1 + 2 + 1 + 3
+    libtw07_map_itemLayerTilemap *pRunTilemap = libtw07_map_reader_getTilemap(&Reader, RunLayer);
+    libtw07_map_itemLayerTilemap *pMixedTilemap = libtw07_map_reader_getTilemap(&Reader, MixedLayer);
+    if(!pRunTilemap || !pMixedTilemap
+        || libtw07_datafile_reader_getDataSize(&Reader, pRunTilemap->m_Data) != 3 * (int) sizeof(libtw07_map_tile)
+        || libtw07_datafile_reader_getDataSize(&Reader, pMixedTilemap->m_Data) != 8 * (int) sizeof(libtw07_map_tile))
+        return -1;
+    libtw07_map_tile *pRunTiles = libtw07_map_reader_getTiles(&Reader, RunLayer);
+    libtw07_map_tile *pMixedTiles = libtw07_map_reader_getTiles(&Reader, MixedLayer);
+    if(!pRunTiles || memcmp(pRunTiles, s_aRunTiles, sizeof(s_aRunTiles)) != 0 || !pMixedTiles || memcmp(pMixedTiles, s_aMixedTiles, sizeof(s_aMixedTiles)) != 0)
+        return -1;
+    libtw07_print("test", "runs past 256 tiles are split and read back");
+
+    libtw07_datafile_reader_getType(&Reader, LIBTW07_MAPITEMTYPE_ENVPOINTS, &Start, &Num);
+    if(Num != 1 || libtw07_datafile_reader_getItemSize(&Reader, Start) != 2 * (int) sizeof(libtw07_map_envPoint))
+        return -1;
+
+    // the collision grid matches the tiles, also past the edges
+    libtw07_collision Collision;
+    if(libtw07_collision_init(&Collision, &Reader, LIBTW07_COLLISION_DEFAULT_BORDER) != 0)
+        return -1;
+    for(int y = -LIBTW07_COLLISION_DEFAULT_BORDER; y < HEIGHT + LIBTW07_COLLISION_DEFAULT_BORDER; y++)
+        for(int x = -LIBTW07_COLLISION_DEFAULT_BORDER; x < WIDTH + LIBTW07_COLLISION_DEFAULT_BORDER; x++)
+        {
+            int Index = aTiles[libtw07_clamp(y, 0, HEIGHT - 1) * WIDTH + libtw07_clamp(x, 0, WIDTH - 1)].m_Index;
+            if(libtw07_collision_getTile(&Collision, x, y) != (Index <= LIBTW07_TILE_NOHOOK ? Index : LIBTW07_TILE_AIR))
+                return -1;
+        }
+    if(!libtw07_collision_checkPoint(&Collision, 5 * 32.0f, (HEIGHT - 1) * 32.0f + 16.0f) || libtw07_collision_checkPoint(&Collision, 5 * 32.0f, 10 * 32.0f)
+        || libtw07_collision_getTileClamped(&Collision, 100000, 20) != LIBTW07_TILE_NOHOOK)
+        return -1;
+    libtw07_print("test", "collision grid uses %d bytes", Collision.m_Stride * (HEIGHT + 2 * Collision.m_Border));
+    libtw07_collision_destroy(&Collision);
+    libtw07_map_reader_unload(&Reader);
+
+    // the tile layers expanded on a pool and the collision grid take their memory from the map's allocator
+    libtw07_allocator Allocator;
+    Allocator.m_pfnAlloc = CountingAlloc;
+    Allocator.m_pfnFree = CountingFree;
+    Allocator.m_pUser = 0;
+    libtw07_jobPool Pool;
+    if(libtw07_jobpool_init(&Pool, 2) != 0)
+        return -1;
+    libtw07_map_reader_init(&Reader);
+    libtw07_datafile_reader_setAllocator(&Reader, &Allocator);
+    if(libtw07_map_reader_open(&Reader, "map_test.map") != 0)
+        return -1;
+    int NumAllocs = libtw07_atomic_load(&s_NumAllocs);
+    if(libtw07_map_reader_loadTiles(&Reader, &Pool) != 0 || memcmp(libtw07_map_reader_getTiles(&Reader, GameLayer), aTiles, sizeof(aTiles)) != 0)
+        return -1;
+    // the task list, the expanded tiles and the scratch buffer of the job
+    if(libtw07_atomic_load(&s_NumAllocs) - NumAllocs < 3)
+        return -1;
+    int NumLive = libtw07_atomic_load(&s_NumLive);
+    if(libtw07_collision_init(&Collision, &Reader, LIBTW07_COLLISION_DEFAULT_BORDER) != 0 || libtw07_atomic_load(&s_NumLive) != NumLive + 1)
+        return -1;
+    libtw07_collision_destroy(&Collision);
+    libtw07_map_reader_unload(&Reader);
+    libtw07_jobpool_destroy(&Pool);
+    if(libtw07_atomic_load(&s_NumLive) != 0)
+        return -1;
+    libtw07_print("test", "%d allocations went through the map's allocator", libtw07_atomic_load(&s_NumAllocs));
+
+    remove("map_test.map");
+    return 0;
+}
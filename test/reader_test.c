@@ -0,0 +1,459 @@
+/*
+ * This file is part of libtw07, a header-only library for teeworlds0.7.
+ *
+ * Copyright (C) 2025 TeeworldsArchive
+ * 
+ * This software is provided 'as-is', without any express or implied
+ * warranty. In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ *
+ */
+#include "../lib/datafile.h"
+
+// checks that the different ways of opening and loading a datafile agree with a plain reader
+
+static int s_NumAllocs = 0;
+
+static void *CountingAlloc(void *pUser, size_t Size)
+{
+    (void)pUser;
+    s_NumAllocs++;
+    return malloc(Size);
+}
+
+static void CountingFree(void *pUser, void *pPtr)
+{
+    (void)pUser;
+    if(pPtr)
+        s_NumAllocs--;
+    free(pPtr);
+}
+
+// hands out memory 4 bytes off a 16 byte boundary, like a backing allocator with a weak alignment
+static void *MisalignedAlloc(void *pUser, size_t Size)
+{
+    (void)pUser;
+    char *pMemory = (char *) malloc(Size + 4);
+    return pMemory ? pMemory + 4 : 0;
+}
+
+static void MisalignedFree(void *pUser, void *pPtr)
+{
+    (void)pUser;
+    if(pPtr)
+        free((char *)pPtr - 4);
+}
+
+// every data block of pReader has the size and the bytes of the one in pRef
+static int SameData(libtw07_datafileReader *pReader, libtw07_datafileReader *pRef)
+{
+    int Num = libtw07_datafile_reader_numData(pRef);
+    if(libtw07_datafile_reader_numData(pReader) != Num)
+        return 0;
+    for(int i = 0; i < Num; i++)
+    {
+        int Size = libtw07_datafile_reader_getDataSize(pRef, i);
+        void *pExpected = libtw07_datafile_reader_getData(pRef, i);
+        void *pData = libtw07_datafile_reader_getData(pReader, i);
+        if(!pExpected || !pData || libtw07_datafile_reader_getDataSize(pReader, i) != Size || memcmp(pData, pExpected, Size) != 0)
+            return 0;
+    }
+    return 1;
+}
+
+static int SameHashes(libtw07_datafileReader *pReader, libtw07_datafileReader *pRef)
+{
+    SHA256_DIGEST Sha256 = libtw07_datafile_reader_sha256(pReader);
+    SHA256_DIGEST RefSha256 = libtw07_datafile_reader_sha256(pRef);
+    return libtw07_datafile_reader_crc(pReader) == libtw07_datafile_reader_crc(pRef) && memcmp(&Sha256, &RefSha256, sizeof(Sha256)) == 0;
+}
+
+// the whole file, the caller frees it
+static void *LoadFile(const char *pFilename, long *pSize)
+{
+    FILE *File = fopen(pFilename, "rb");
+    if(!File)
+        return 0;
+    fseek(File, 0, SEEK_END);
+    *pSize = ftell(File);
+    fseek(File, 0, SEEK_SET);
+    void *pData = malloc(*pSize);
+    if(pData && fread(pData, 1, *pSize, File) != (size_t)*pSize)
+    {
+        free(pData);
+        pData = 0;
+    }
+    fclose(File);
+    return pData;
+}
+
+// a version 3 file with one uncompressed data block, cut off Missing bytes before its end
+static int WriteV3File(const char *pFilename, int Missing)
+{
+    int aFile[9 + 1 + 2] = {0, 3, 0, 0, 0, 0, 1, 0, 8, 0, 0x11223344, 0x55667788};
+    memcpy(&aFile[0], "DATA", 4);
+    aFile[2] = sizeof(aFile) - 16;
+    aFile[3] = aFile[2] - 8;
+    FILE *File = fopen(pFilename, "wb");
+    if(!File)
+        return -1;
+    int Failed = fwrite(aFile, 1, sizeof(aFile) - Missing, File) != sizeof(aFile) - Missing;
+    return fclose(File) != 0 || Failed ? -1 : 0;
+}
+
+// one job of the threaded test, it fetches the blocks of a shared reader over and over
+struct CAccessJob
+{
+    libtw07_job m_Job;
+    libtw07_datafileReader *m_pReader;
+    libtw07_datafileReader *m_pRef;
+    int m_Pin;
+    int m_First;
+};
+
+static int AccessJob(void *pUser)
+{
+    struct CAccessJob *pJob = (struct CAccessJob *)pUser;
+    int Num = libtw07_datafile_reader_numData(pJob->m_pRef);
+    for(int Round = 0; Round < 200; Round++)
+    {
+        int Index = (pJob->m_First + Round) % Num;
+        int Size = libtw07_datafile_reader_getDataSize(pJob->m_pRef, Index);
+        void *pExpected = libtw07_datafile_reader_getData(pJob->m_pRef, Index);
+        // plain getData keeps a block loaded for good, only block 0 is taken that way so the cache can evict the rest
+        void *pData = pJob->m_Pin ? libtw07_datafile_reader_pinData(pJob->m_pReader, Index) : libtw07_datafile_reader_getData(pJob->m_pReader, 0);
+        if(!pJob->m_Pin)
+        {
+            Size = libtw07_datafile_reader_getDataSize(pJob->m_pRef, 0);
+            pExpected = libtw07_datafile_reader_getData(pJob->m_pRef, 0);
+        }
+        int Same = pData && memcmp(pData, pExpected, Size) == 0;
+        if(pJob->m_Pin)
+            libtw07_datafile_reader_unpinData(pJob->m_pReader, Index);
+        if(!Same)
+            return -1;
+    }
+    return 0;
+}
+
+// loads and unloads the blocks of a cached reader while the other jobs do the same
+static int UnloadJob(void *pUser)
+{
+    struct CAccessJob *pJob = (struct CAccessJob *)pUser;
+    int Num = libtw07_datafile_reader_numData(pJob->m_pRef);
+    for(int Round = 0; Round < 200; Round++)
+    {
+        int Index = (pJob->m_First + Round) % Num;
+        void *pData = libtw07_datafile_reader_pinData(pJob->m_pReader, Index);
+        int Same = pData && memcmp(pData, libtw07_datafile_reader_getData(pJob->m_pRef, Index), libtw07_datafile_reader_getDataSize(pJob->m_pRef, Index)) == 0;
+        libtw07_datafile_reader_unpinData(pJob->m_pReader, Index);
+        libtw07_datafile_reader_getData(pJob->m_pReader, (Index + 1) % Num);
+        libtw07_datafile_reader_unloadData(pJob->m_pReader, Index);
+        if(!Same)
+            return -1;
+    }
+    return 0;
+}
+
+int main(int argc, const char **argv)
+{
+    libtw07_datafileReader Ref;
+    libtw07_datafile_reader_init(&Ref);
+    if(libtw07_datafile_reader_open(&Ref, "test.map") != 0)
+        return -1;
+
+    // a mapped file gives the same blocks as a buffered one
+    libtw07_datafileReader Reader;
+    libtw07_datafile_reader_init(&Reader);
+    if(libtw07_datafile_reader_openEx(&Reader, "test.map", LIBTW07_DATAFILE_OPENFLAG_MMAP) != 0)
+        return -1;
+    if(!SameData(&Reader, &Ref))
+        return -1;
+    libtw07_datafile_reader_close(&Reader);
+    printf("mmap matches the plain reader\n");
+
+    // the hashes taken while opening are those of the whole file, mapped or not
+    long FileSize;
+    unsigned char *pFileData = (unsigned char *) LoadFile("test.map", &FileSize);
+    if(!pFileData)
+        return -1;
+    SHA256_DIGEST FileSha256 = sha256(pFileData, FileSize);
+    SHA256_DIGEST RefSha256 = libtw07_datafile_reader_sha256(&Ref);
+    if(libtw07_datafile_reader_crc(&Ref) != crc32(crc32(0L, 0x0, 0), pFileData, FileSize) || memcmp(&RefSha256, &FileSha256, sizeof(FileSha256)) != 0)
+        return -1;
+    free(pFileData);
+    if(libtw07_datafile_reader_openEx(&Reader, "test.map", LIBTW07_DATAFILE_OPENFLAG_MMAP) != 0 || !SameHashes(&Reader, &Ref))
+        return -1;
+    libtw07_datafile_reader_close(&Reader);
+    printf("the hashes taken while opening match the file\n");
+
+    // deferred hashes are taken on the first call, before or after blocks were loaded
+    if(libtw07_datafile_reader_openEx(&Reader, "test.map", LIBTW07_DATAFILE_OPENFLAG_MMAP|LIBTW07_DATAFILE_OPENFLAG_HASH_LAZY) != 0)
+        return -1;
+    if(!SameData(&Reader, &Ref) || !SameHashes(&Reader, &Ref))
+        return -1;
+    libtw07_datafile_reader_close(&Reader);
+    if(libtw07_datafile_reader_openEx(&Reader, "test.map", LIBTW07_DATAFILE_OPENFLAG_HASH_LAZY) != 0)
+        return -1;
+    if(!SameHashes(&Reader, &Ref) || !SameData(&Reader, &Ref))
+        return -1;
+    libtw07_datafile_reader_close(&Reader);
+    if(libtw07_datafile_reader_openEx(&Reader, "test.map", LIBTW07_DATAFILE_OPENFLAG_HASH_NONE) != 0)
+        return -1;
+    if(libtw07_datafile_reader_crc(&Reader) != 0xFFFFFFFF || !SameData(&Reader, &Ref))
+        return -1;
+    libtw07_datafile_reader_close(&Reader);
+    printf("lazy hashing matches the plain reader\n");
+
+    // the item index finds the same items as a linear scan, including ids that do not exist
+    int NumItems = libtw07_datafile_reader_numItems(&Ref);
+    for(int i = 0; i < NumItems; i++)
+    {
+        int Type, ID;
+        libtw07_datafile_reader_getItem(&Ref, i, &Type, &ID);
+        for(int Probe = ID - 1; Probe <= ID + 1; Probe++)
+        {
+            void *pLinear = 0;
+            for(int k = 0; k < NumItems && !pLinear; k++)
+            {
+                int OtherType, OtherID;
+                void *pItem = libtw07_datafile_reader_getItem(&Ref, k, &OtherType, &OtherID);
+                if(OtherType == Type && OtherID == Probe)
+                    pLinear = pItem;
+            }
+            if(libtw07_datafile_reader_findItem(&Ref, Type, Probe) != pLinear)
+                return -1;
+        }
+    }
+    printf("findItem matches a linear scan for %d items\n", NumItems);
+
+    // loading ahead gives the blocks getData loads, without a pool and with one, buffered and mapped
+    int NumData = libtw07_datafile_reader_numData(&Ref);
+    libtw07_jobPool Pool;
+    if(libtw07_jobpool_init(&Pool, 4) != 0)
+        return -1;
+    for(int Mode = 0; Mode < 4; Mode++)
+    {
+        libtw07_jobPool *pPool = Mode&1 ? &Pool : 0;
+        if(libtw07_datafile_reader_openEx(&Reader, "test.map", Mode&2 ? LIBTW07_DATAFILE_OPENFLAG_MMAP : 0) != 0)
+            return -1;
+        int aIndices[3] = {NumData - 1, 0, NumData - 1};
+        if(libtw07_datafile_reader_loadData(&Reader, aIndices, 3, pPool) != 0)
+            return -1;
+        if(libtw07_datafile_reader_loadAll(&Reader, pPool) != 0 || !SameData(&Reader, &Ref))
+        {
+            printf("loaded data differs, pool=%d mapped=%d\n", Mode&1, (Mode&2) != 0);
+            return -1;
+        }
+        libtw07_datafile_reader_close(&Reader);
+    }
+    printf("loadData and loadAll match getData for %d blocks\n", NumData);
+
+    // many jobs fetch the same blocks from one reader at once, buffered and mapped, with and without
+    // a cache that evicts every unpinned block right away
+    for(int Mode = 0; Mode < 4; Mode++)
+    {
+        if(libtw07_datafile_reader_openEx(&Reader, "test.map", Mode&1 ? LIBTW07_DATAFILE_OPENFLAG_MMAP : 0) != 0)
+            return -1;
+        if(Mode&2 && libtw07_datafile_reader_setCacheBudget(&Reader, 1) != 0)
+            return -1;
+
+        struct CAccessJob aJobs[16];
+        for(int j = 0; j < 16; j++)
+        {
+            aJobs[j].m_pReader = &Reader;
+            aJobs[j].m_pRef = &Ref;
+            aJobs[j].m_Pin = j % 4 != 0;
+            aJobs[j].m_First = j;
+            libtw07_jobpool_add(&Pool, &aJobs[j].m_Job, AccessJob, &aJobs[j]);
+        }
+        int Failed = 0;
+        for(int j = 0; j < 16; j++)
+            Failed |= libtw07_jobpool_wait(&Pool, &aJobs[j].m_Job) != 0;
+
+        // block 0 was handed out by getData, everything else was unpinned and evicted
+        libtw07_datafileCacheStats Stats;
+        libtw07_datafile_reader_getCacheStats(&Reader, &Stats);
+        if(Failed || (Mode&2 && (Stats.m_Evictions == 0 || Stats.m_ResidentBytes != libtw07_datafile_reader_getDataSize(&Reader, 0))))
+        {
+            printf("threaded access failed, mapped=%d cache=%d\n", Mode&1, (Mode&2) != 0);
+            return -1;
+        }
+        libtw07_datafile_reader_close(&Reader);
+    }
+    printf("threaded getData and pinData match the plain reader\n");
+
+    // unloading waits for blocks other jobs are loading, afterwards nothing is left resident
+    for(int Mapped = 0; Mapped < 2; Mapped++)
+    {
+        if(libtw07_datafile_reader_openEx(&Reader, "test.map", Mapped ? LIBTW07_DATAFILE_OPENFLAG_MMAP : 0) != 0 || libtw07_datafile_reader_setCacheBudget(&Reader, 1 << 20) != 0)
+            return -1;
+        struct CAccessJob aJobs[16];
+        for(int j = 0; j < 16; j++)
+        {
+            aJobs[j].m_pReader = &Reader;
+            aJobs[j].m_pRef = &Ref;
+            aJobs[j].m_First = j;
+            libtw07_jobpool_add(&Pool, &aJobs[j].m_Job, UnloadJob, &aJobs[j]);
+        }
+        int Failed = 0;
+        for(int j = 0; j < 16; j++)
+            Failed |= libtw07_jobpool_wait(&Pool, &aJobs[j].m_Job) != 0;
+        for(int i = 0; i < NumData; i++)
+            libtw07_datafile_reader_unloadData(&Reader, i);
+        libtw07_datafileCacheStats Stats;
+        libtw07_datafile_reader_getCacheStats(&Reader, &Stats);
+        if(Failed || Stats.m_ResidentBytes != 0)
+        {
+            printf("threaded unloading failed, mapped=%d\n", Mapped);
+            return -1;
+        }
+        libtw07_datafile_reader_close(&Reader);
+    }
+    printf("threaded unloadData waits for loading blocks\n");
+
+    // with no budget only the pinned block stays, evicted blocks are loaded again on demand
+    if(libtw07_datafile_reader_open(&Reader, "test.map") != 0 || libtw07_datafile_reader_setCacheBudget(&Reader, 0) != 0)
+        return -1;
+    void *pPinned = libtw07_datafile_reader_pinData(&Reader, 0);
+    if(!pPinned || libtw07_datafile_reader_loadAll(&Reader, &Pool) != 0)
+        return -1;
+    libtw07_datafileCacheStats Stats;
+    libtw07_datafile_reader_getCacheStats(&Reader, &Stats);
+    if(Stats.m_Evictions != NumData - 1 || Stats.m_ResidentBytes != libtw07_datafile_reader_getDataSize(&Reader, 0))
+        return -1;
+    char *pReplacement = (char *) libtw07_datafile_reader_allocData(&Reader, 4);
+    if(libtw07_datafile_reader_replaceData(&Reader, 0, pReplacement, 4) != -1)
+        return -1;
+    libtw07_datafile_reader_freeData(&Reader, pReplacement);
+    if(libtw07_datafile_reader_getData(&Reader, 0) != pPinned)
+        return -1;
+    libtw07_datafile_reader_unpinData(&Reader, 0);
+    libtw07_datafile_reader_unloadData(&Reader, 0);
+    libtw07_datafile_reader_getCacheStats(&Reader, &Stats);
+    if(Stats.m_ResidentBytes != 0 || !SameData(&Reader, &Ref))
+        return -1;
+    libtw07_datafile_reader_close(&Reader);
+
+    // replaced data counts against the budget, unpinned blocks are evicted to make room for it
+    if(libtw07_datafile_reader_open(&Reader, "test.map") != 0 || libtw07_datafile_reader_setCacheBudget(&Reader, libtw07_datafile_reader_getDataSize(&Ref, 1)) != 0)
+        return -1;
+    if(!libtw07_datafile_reader_pinData(&Reader, 1))
+        return -1;
+    libtw07_datafile_reader_unpinData(&Reader, 1);
+    pReplacement = (char *) libtw07_datafile_reader_allocData(&Reader, 64);
+    if(libtw07_datafile_reader_replaceData(&Reader, 0, pReplacement, 64) != 0 || libtw07_datafile_reader_getData(&Reader, 0) != pReplacement)
+        return -1;
+    libtw07_datafile_reader_getCacheStats(&Reader, &Stats);
+    if(Stats.m_Evictions != 1 || Stats.m_ResidentBytes != 64 || !libtw07_datafile_reader_isDataReplaced(&Reader, 0))
+        return -1;
+    libtw07_datafile_reader_close(&Reader);
+    printf("the cache keeps pinned blocks and evicts the rest\n");
+
+    // a file read into memory by the caller, handed over to the reader or borrowed with lazy hashing
+    pFileData = (unsigned char *) LoadFile("test.map", &FileSize);
+    if(!pFileData || libtw07_datafile_reader_openMemory(&Reader, pFileData, 16, LIBTW07_DATAFILE_MEMORY_TAKE) != -1)
+        return -1;
+    if(libtw07_datafile_reader_openMemoryEx(&Reader, pFileData, FileSize, LIBTW07_DATAFILE_MEMORY_BORROW, LIBTW07_DATAFILE_OPENFLAG_HASH_NONE) != 0)
+        return -1;
+    if(libtw07_datafile_reader_crc(&Reader) != 0xFFFFFFFF || !SameData(&Reader, &Ref))
+        return -1;
+    libtw07_datafile_reader_close(&Reader);
+    if(libtw07_datafile_reader_openMemoryEx(&Reader, pFileData, FileSize, LIBTW07_DATAFILE_MEMORY_BORROW, LIBTW07_DATAFILE_OPENFLAG_HASH_LAZY) != 0)
+        return -1;
+    if(libtw07_datafile_reader_isOpen(&Reader) != 0 || Reader.m_pDataFile->m_Hashed || !SameHashes(&Reader, &Ref) || !SameData(&Reader, &Ref))
+        return -1;
+    libtw07_datafile_reader_close(&Reader);
+    if(libtw07_datafile_reader_openMemory(&Reader, pFileData, FileSize, LIBTW07_DATAFILE_MEMORY_TAKE) != 0)
+        return -1;
+    if(!SameData(&Reader, &Ref) || !SameHashes(&Reader, &Ref))
+        return -1;
+    libtw07_datafile_reader_close(&Reader);
+    printf("openMemory matches the plain reader\n");
+
+    // all memory goes through the allocator, with and without an arena on top of it
+    libtw07_allocator Allocator;
+    Allocator.m_pfnAlloc = CountingAlloc;
+    Allocator.m_pfnFree = CountingFree;
+    Allocator.m_pUser = 0;
+    for(int UseArena = 0; UseArena < 2; UseArena++)
+    {
+        libtw07_datafile_reader_setAllocator(&Reader, &Allocator);
+        libtw07_datafile_reader_setArena(&Reader, UseArena ? 16 * 1024 : 0);
+        if(libtw07_datafile_reader_open(&Reader, "test.map") != 0 || !SameData(&Reader, &Ref))
+            return -1;
+        if(s_NumAllocs == 0 || (libtw07_datafile_reader_setCacheBudget(&Reader, 0) == 0) == UseArena)
+            return -1;
+        libtw07_datafile_reader_close(&Reader);
+        if(s_NumAllocs != 0)
+            return -1;
+    }
+    libtw07_datafile_reader_setAllocator(&Reader, 0);
+    libtw07_datafile_reader_setArena(&Reader, 0);
+    printf("allocator and arena release everything on close\n");
+
+    // arena allocations are aligned whatever the backing memory and the header size are
+    libtw07_allocator Misaligned;
+    Misaligned.m_pfnAlloc = MisalignedAlloc;
+    Misaligned.m_pfnFree = MisalignedFree;
+    Misaligned.m_pUser = 0;
+    libtw07_arena Arena;
+    libtw07_arena_init(&Arena, &Misaligned, 256);
+    for(int Size = 1; Size < 300; Size += 7)
+    {
+        void *pMemory = libtw07_arena_alloc(&Arena, Size);
+        if(!pMemory || (uintptr_t)pMemory % LIBTW07_ARENA_ALIGNMENT != 0)
+            return -1;
+        memset(pMemory, 0xAB, Size);
+        // the most recent allocation is given back and handed out again
+        libtw07_arena_free(&Arena, pMemory);
+        if(libtw07_arena_alloc(&Arena, Size) != pMemory)
+            return -1;
+    }
+    libtw07_arena_destroy(&Arena);
+    printf("arena allocations are %d byte aligned\n", LIBTW07_ARENA_ALIGNMENT);
+
+    // decompressing into a caller buffer gives the loaded bytes and refuses a buffer that is too small
+    for(int i = 0; i < NumData; i++)
+    {
+        int Size = libtw07_datafile_reader_getDataSize(&Ref, i);
+        char *pBuffer = (char *) malloc(Size + 1);
+        if(libtw07_datafile_reader_readDataInto(&Ref, i, pBuffer, Size) != Size || memcmp(pBuffer, libtw07_datafile_reader_getData(&Ref, i), Size) != 0)
+            return -1;
+        if(Size > 0 && libtw07_datafile_reader_readDataInto(&Ref, i, pBuffer, Size - 1) != -1)
+            return -1;
+        free(pBuffer);
+    }
+    printf("readDataInto matches getData for %d blocks\n", NumData);
+
+    // a truncated uncompressed block fails to load and stays unloaded
+    if(WriteV3File("reader_test.file", 4) != 0 || libtw07_datafile_reader_open(&Reader, "reader_test.file") != 0)
+        return -1;
+    if(libtw07_datafile_reader_getData(&Reader, 0) != 0 || libtw07_datafile_reader_loadAll(&Reader, 0) != -1 || libtw07_datafile_reader_getData(&Reader, 0) != 0)
+        return -1;
+    libtw07_datafile_reader_close(&Reader);
+    if(WriteV3File("reader_test.file", 0) != 0 || libtw07_datafile_reader_open(&Reader, "reader_test.file") != 0)
+        return -1;
+    int *pV3Data = (int *) libtw07_datafile_reader_getData(&Reader, 0);
+    if(!pV3Data || libtw07_datafile_reader_getDataSize(&Reader, 0) != 8 || pV3Data[1] != 0x55667788)
+        return -1;
+    libtw07_datafile_reader_close(&Reader);
+    remove("reader_test.file");
+    printf("a truncated version 3 block is not loaded\n");
+
+    libtw07_jobpool_destroy(&Pool);
+    libtw07_datafile_reader_close(&Ref);
+    return 0;
+}
@@ -0,0 +1,120 @@
+/*
+ * This file is part of libtw07, a header-only library for teeworlds0.7.
+ *
+ * Copyright (C) 2025 TeeworldsArchive
+ * 
+ * This software is provided 'as-is', without any express or implied
+ * warranty. In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ *
+ */
+#include <time.h>
+
+#include "../lib/map.h"
+
+// compares tile layer expansion with the per tile loop it replaced
+
+enum
+{
+    WIDTH = 1000,
+    HEIGHT = 1000,
+    NUM_TILES = WIDTH * HEIGHT,
+};
+
+// folds equal neighbours into m_Skip, the way maps store their tile layers
+static int Encode(const libtw07_map_tile *pTiles, libtw07_map_tile *pSaved)
+{
+    int Num = 0;
+    for(int i = 0; i < NUM_TILES; i++)
+    {
+        if(Num && pSaved[Num-1].m_Skip < 255 && pSaved[Num-1].m_Index == pTiles[i].m_Index && pSaved[Num-1].m_Flags == pTiles[i].m_Flags)
+            pSaved[Num-1].m_Skip++;
+        else
+            pSaved[Num++] = pTiles[i];
+    }
+    return Num;
+}
+
+static void ExpandLoop(libtw07_map_tile *pTiles, const libtw07_map_tile *pSavedTiles)
+{
+    int i = 0;
+    while(i < NUM_TILES)
+    {
+        for(unsigned Counter = 0; Counter <= pSavedTiles->m_Skip && i < NUM_TILES; Counter++)
+        {
+            pTiles[i] = *pSavedTiles;
+            pTiles[i++].m_Skip = 0;
+        }
+
+        pSavedTiles++;
+    }
+}
+
+static int Bench(const char *pName, int MaxRun, int Rounds)
+{
+    libtw07_map_tile *pTiles = (libtw07_map_tile *) calloc(NUM_TILES, sizeof(libtw07_map_tile));
+    libtw07_map_tile *pSaved = (libtw07_map_tile *) calloc(NUM_TILES, sizeof(libtw07_map_tile));
+    libtw07_map_tile *pLoop = (libtw07_map_tile *) calloc(NUM_TILES, sizeof(libtw07_map_tile));
+    libtw07_map_tile *pExpanded = (libtw07_map_tile *) calloc(NUM_TILES, sizeof(libtw07_map_tile));
+
+    // runs of random length up to MaxRun, about half of them air
+    srand(1);
+    for(int i = 0; i < NUM_TILES;)
+    {
+        int Run = 1 + rand() % MaxRun;
+        unsigned char Index = rand() % 2 ? 0 : 1 + rand() % 255;
+        for(int k = 0; k < Run && i < NUM_TILES; k++, i++)
+            pTiles[i].m_Index = Index;
+    }
+    int NumSaved = Encode(pTiles, pSaved);
+
+    clock_t Start = clock();
+    for(int r = 0; r < Rounds; r++)
+        ExpandLoop(pLoop, pSaved);
+    double LoopTime = (double)(clock() - Start) / CLOCKS_PER_SEC / Rounds;
+
+    Start = clock();
+    for(int r = 0; r < Rounds; r++)
+        libtw07_map_expandTiles(pExpanded, NUM_TILES, pSaved, NumSaved);
+    double Time = (double)(clock() - Start) / CLOCKS_PER_SEC / Rounds;
+
+    int Same = memcmp(pLoop, pExpanded, NUM_TILES * sizeof(libtw07_map_tile)) == 0 && memcmp(pTiles, pExpanded, NUM_TILES * sizeof(libtw07_map_tile)) == 0;
+
+    // a stream that ends early has to be refused, not read past
+    if(libtw07_map_expandTiles(pExpanded, NUM_TILES, pSaved, NumSaved - 1) != -1)
+    {
+        printf("%-8s truncated stream was accepted\n", pName);
+        Same = 0;
+    }
+    printf("%-8s %7d saved tiles  loop %8.3f ms  expand %8.3f ms  %s\n", pName, NumSaved, LoopTime * 1000.0, Time * 1000.0, Same ? "ok" : "MISMATCH");
+
+    free(pTiles);
+    free(pSaved);
+    free(pLoop);
+    free(pExpanded);
+    return Same ? 0 : 1;
+}
+
+int main(int argc, const char **argv)
+{
+    int Rounds = argc > 1 ? atoi(argv[1]) : 20;
+
+    int Failed = 0;
+    Failed |= Bench("single", 1, Rounds);
+    Failed |= Bench("short", 8, Rounds);
+    Failed |= Bench("medium", 64, Rounds);
+    Failed |= Bench("long", 1024, Rounds);
+    return Failed;
+}
@@ -0,0 +1,84 @@
+/*
+ * This file is part of libtw07, a header-only library for teeworlds0.7.
+ *
+ * Copyright (C) 2025 TeeworldsArchive
+ * 
+ * This software is provided 'as-is', without any express or implied
+ * warranty. In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ *
+ */
+#include <time.h>
+
+#include "../lib/datafile.h"
+
+// rewrites the data blocks of a map with every compression setting and reports time and size
+static void Bench(libtw07_datafileReader *pReader, const char *pName, int Level, int Strategy, int Rounds)
+{
+    clock_t Start = clock();
+    long Size = 0;
+    for(int r = 0; r < Rounds; r++)
+    {
+        libtw07_datafileWriter Writer;
+        libtw07_datafile_writer_init(&Writer);
+        libtw07_datafile_writer_setCompression(&Writer, Level, Strategy);
+        libtw07_datafile_writer_open(&Writer, "bench.file");
+
+        // only the data blocks are compressed, the items do not matter here
+        for(int i = 0; i < libtw07_datafile_reader_numData(pReader); i++)
+            libtw07_datafile_writer_addData(&Writer, libtw07_datafile_reader_getDataSize(pReader, i), libtw07_datafile_reader_getData(pReader, i));
+
+        libtw07_datafile_writer_finish(&Writer);
+        libtw07_datafile_writer_destroy(&Writer);
+
+        FILE *File = fopen("bench.file", "rb");
+        if(!File)
+        {
+            printf("%-16s level=%2d  the file was not written\n", pName, Level);
+            return;
+        }
+        fseek(File, 0, SEEK_END);
+        Size = ftell(File);
+        fclose(File);
+    }
+    remove("bench.file");
+    double Time = (double)(clock() - Start) / CLOCKS_PER_SEC / Rounds;
+    printf("%-16s level=%2d  %8.3f ms  %8ld bytes\n", pName, Level, Time * 1000.0, Size);
+}
+
+int main(int argc, const char **argv)
+{
+    const char *pFilename = argc > 1 ? argv[1] : "test.map";
+    int Rounds = argc > 2 ? atoi(argv[2]) : 20;
+
+    libtw07_datafileReader Reader;
+    libtw07_datafile_reader_init(&Reader);
+    if(libtw07_datafile_reader_open(&Reader, pFilename) != 0)
+    {
+        printf("could not open %s\n", pFilename);
+        return 1;
+    }
+
+    Bench(&Reader, "store", LIBTW07_DATAFILE_COMPRESSION_STORE, LIBTW07_DATAFILE_STRATEGY_DEFAULT, Rounds);
+    for(int Level = 1; Level <= 9; Level++)
+        Bench(&Reader, "default", Level, LIBTW07_DATAFILE_STRATEGY_DEFAULT, Rounds);
+    Bench(&Reader, "default", LIBTW07_DATAFILE_COMPRESSION_DEFAULT, LIBTW07_DATAFILE_STRATEGY_DEFAULT, Rounds);
+    Bench(&Reader, "filtered", LIBTW07_DATAFILE_COMPRESSION_DEFAULT, LIBTW07_DATAFILE_STRATEGY_FILTERED, Rounds);
+    Bench(&Reader, "rle", LIBTW07_DATAFILE_COMPRESSION_DEFAULT, LIBTW07_DATAFILE_STRATEGY_RLE, Rounds);
+    Bench(&Reader, "huffman only", LIBTW07_DATAFILE_COMPRESSION_DEFAULT, LIBTW07_DATAFILE_STRATEGY_HUFFMAN_ONLY, Rounds);
+
+    libtw07_datafile_reader_close(&Reader);
+    return 0;
+}
@@ -0,0 +1,376 @@
+/*
+ * This file is part of libtw07, a header-only library for teeworlds0.7.
+ *
+ * Copyright (C) 2025 TeeworldsArchive
+ * 
+ * This software is provided 'as-is', without any express or implied
+ * warranty. In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ *
+ */
+#include "../lib/datafile.h"
+
+// writes the blocks and items of a map in every writer mode and checks the files are byte identical
+
+enum
+{
+    MODE_PLAIN = 0,
+    MODE_POOL,
+    MODE_BORROW,
+    MODE_TAKE,
+    MODE_FILE,
+    MODE_CALLBACK,
+    MODE_SPILL,
+    MODE_SPILL_POOL,
+    MODE_RAW,
+    MODE_DEDUP,
+    NUM_MODES,
+};
+
+static const char *s_apModeNames[NUM_MODES] = {"plain", "pool", "borrow", "take", "file", "callback", "spill", "spill pool", "raw", "dedup"};
+
+struct CCallbackFile
+{
+    char *m_pData;
+    int m_Size;
+};
+
+static int AppendCallback(void *pUser, const void *pData, int Size)
+{
+    struct CCallbackFile *pFile = (struct CCallbackFile *)pUser;
+    char *pNew = (char *) realloc(pFile->m_pData, pFile->m_Size + Size);
+    if(!pNew)
+        return -1;
+    memcpy(pNew + pFile->m_Size, pData, Size);
+    pFile->m_pData = pNew;
+    pFile->m_Size += Size;
+    return 0;
+}
+
+enum
+{
+    NUM_LARGE_ITEMS = 100000,
+    NUM_LARGE_DATAS = 2000,
+    NUM_LARGE_TYPES = 5,
+};
+
+static void *Copy(const void *pData, int Size)
+{
+    void *pCopy = malloc(Size + 1);
+    memcpy(pCopy, pData, Size);
+    return pCopy;
+}
+
+// adds every block and item of pSource, returns the finished file or 0
+static char *Write(libtw07_datafileReader *pSource, libtw07_jobPool *pPool, int Mode, int *pSize, SHA256_DIGEST *pSha256, uint32_t *pCrc)
+{
+    libtw07_datafileWriter Writer;
+    libtw07_datafile_writer_init(&Writer);
+    struct CCallbackFile Callback = {0, 0};
+    if(Mode == MODE_FILE)
+        libtw07_datafile_writer_open(&Writer, "writer_test.file");
+    else if(Mode == MODE_CALLBACK)
+        libtw07_datafile_writer_openCallback(&Writer, AppendCallback, &Callback);
+    else
+        libtw07_datafile_writer_openMemory(&Writer);
+    if(Mode == MODE_POOL || Mode == MODE_SPILL_POOL)
+        libtw07_datafile_writer_setJobPool(&Writer, pPool);
+    if((Mode == MODE_SPILL || Mode == MODE_SPILL_POOL) && libtw07_datafile_writer_enableSpill(&Writer) != 0)
+        return 0;
+    if(Mode == MODE_DEDUP)
+        libtw07_datafile_writer_setDedup(&Writer, 1);
+
+    int Ownership = Mode == MODE_BORROW ? LIBTW07_DATAFILE_BUFFER_BORROW : Mode == MODE_TAKE ? LIBTW07_DATAFILE_BUFFER_TAKE : LIBTW07_DATAFILE_BUFFER_COPY;
+    for(int i = 0; i < libtw07_datafile_reader_numData(pSource); i++)
+    {
+        int Index;
+        if(Mode == MODE_RAW)
+            Index = libtw07_datafile_writer_addRawData(&Writer, pSource, i);
+        else
+        {
+            int Size = libtw07_datafile_reader_getDataSize(pSource, i);
+            void *pData = libtw07_datafile_reader_getData(pSource, i);
+            if(Ownership == LIBTW07_DATAFILE_BUFFER_TAKE)
+                pData = Copy(pData, Size);
+            Index = libtw07_datafile_writer_addDataEx(&Writer, Size, pData, Writer.m_Level, Writer.m_Strategy, Ownership);
+        }
+        if(Index != i)
+            return 0;
+    }
+    int NumItems = 0;
+    for(int i = 0; i < libtw07_datafile_reader_numItems(pSource); i++)
+    {
+        int Type, ID;
+        void *pItem = libtw07_datafile_reader_getItem(pSource, i, &Type, &ID);
+        int Size = libtw07_datafile_reader_getItemSize(pSource, i);
+        if(Type >= 0xFFFF) // the uuid index of extended item types, addItem does not take it
+            continue;
+        if(Ownership == LIBTW07_DATAFILE_BUFFER_TAKE)
+            pItem = Copy(pItem, Size);
+        if(libtw07_datafile_writer_addItemEx(&Writer, Type, ID, Size, pItem, Ownership) != NumItems++)
+            return 0;
+    }
+
+    if(!libtw07_datafile_writer_finish(&Writer))
+        return 0;
+    *pSha256 = libtw07_datafile_writer_sha256(&Writer);
+    *pCrc = libtw07_datafile_writer_crc(&Writer);
+
+    char *pFile = 0;
+    if(Mode == MODE_FILE)
+    {
+        libtw07_datafile_writer_destroy(&Writer);
+        FILE *File = fopen("writer_test.file", "rb");
+        if(!File)
+            return 0;
+        fseek(File, 0, SEEK_END);
+        *pSize = (int) ftell(File);
+        fseek(File, 0, SEEK_SET);
+        pFile = (char *) malloc(*pSize);
+        if(fread(pFile, 1, *pSize, File) != (size_t) *pSize)
+            *pSize = -1;
+        fclose(File);
+        remove("writer_test.file");
+        return pFile;
+    }
+    if(Mode == MODE_CALLBACK)
+    {
+        pFile = Callback.m_pData;
+        *pSize = Callback.m_Size;
+    }
+    else
+        pFile = (char *) libtw07_datafile_writer_takeMemory(&Writer, pSize);
+    libtw07_datafile_writer_destroy(&Writer);
+    return pFile;
+}
+
+// writes the blocks of pSource with one compression setting and reads them back
+static int WriteCompressed(libtw07_datafileReader *pSource, int Level, int Strategy)
+{
+    libtw07_datafileWriter Writer;
+    libtw07_datafile_writer_init(&Writer);
+    libtw07_datafile_writer_openMemory(&Writer);
+    libtw07_datafile_writer_setCompression(&Writer, Level, Strategy);
+    for(int i = 0; i < libtw07_datafile_reader_numData(pSource); i++)
+    {
+        if(libtw07_datafile_writer_addData(&Writer, libtw07_datafile_reader_getDataSize(pSource, i), libtw07_datafile_reader_getData(pSource, i)) != i)
+            return -1;
+    }
+    if(!libtw07_datafile_writer_finish(&Writer))
+        return -1;
+    int Size;
+    void *pFile = libtw07_datafile_writer_takeMemory(&Writer, &Size);
+    libtw07_datafile_writer_destroy(&Writer);
+
+    libtw07_datafileReader Reader;
+    libtw07_datafile_reader_init(&Reader);
+    if(libtw07_datafile_reader_openMemory(&Reader, pFile, Size, LIBTW07_DATAFILE_MEMORY_TAKE) != 0)
+    {
+        free(pFile);
+        return -1;
+    }
+    int Failed = libtw07_datafile_reader_numData(&Reader) != libtw07_datafile_reader_numData(pSource);
+    for(int i = 0; i < libtw07_datafile_reader_numData(pSource) && !Failed; i++)
+    {
+        int DataSize = libtw07_datafile_reader_getDataSize(pSource, i);
+        void *pData = libtw07_datafile_reader_getData(&Reader, i);
+        Failed = !pData || libtw07_datafile_reader_getDataSize(&Reader, i) != DataSize || memcmp(pData, libtw07_datafile_reader_getData(pSource, i), DataSize) != 0;
+    }
+    libtw07_datafile_reader_close(&Reader);
+    return Failed ? -1 : 0;
+}
+
+// writes far more items and data blocks than the old fixed tables held and reads them back.
+// with a pool the blocks are spilled, only a bounded number of them may stay in memory
+static int WriteLarge(int Reserve, libtw07_jobPool *pPool)
+{
+    libtw07_datafileWriter Writer;
+    libtw07_datafile_writer_init(&Writer);
+    libtw07_datafile_writer_openMemory(&Writer);
+    if(pPool)
+    {
+        libtw07_datafile_writer_setJobPool(&Writer, pPool);
+        if(libtw07_datafile_writer_enableSpill(&Writer) != 0)
+            return -1;
+    }
+    if(Reserve && libtw07_datafile_writer_reserve(&Writer, NUM_LARGE_ITEMS, NUM_LARGE_DATAS) != 0)
+        return -1;
+    int ItemsCapacity = Writer.m_ItemsCapacity;
+    int DatasCapacity = Writer.m_DatasCapacity;
+
+    for(int i = 0; i < NUM_LARGE_DATAS; i++)
+    {
+        int aData[4] = {i, i * 3, i * 5, i * 7};
+        if(libtw07_datafile_writer_addData(&Writer, sizeof(aData), aData) != i)
+            return -1;
+        if(pPool)
+        {
+            int NumInMemory = 0;
+            for(int d = Writer.m_NumSpilled; d < Writer.m_NumDatas; d++)
+                NumInMemory += Writer.m_pDatas[d].m_SpillOffset < 0;
+            if(NumInMemory > LIBTW07_DATAFILE_WRITER_SPILL_QUEUE)
+                return -1;
+        }
+    }
+    for(int i = 0; i < NUM_LARGE_ITEMS; i++)
+    {
+        int aItem[2] = {i, i % NUM_LARGE_DATAS};
+        if(libtw07_datafile_writer_addItem(&Writer, i % NUM_LARGE_TYPES, i / NUM_LARGE_TYPES, sizeof(aItem), aItem) != i)
+            return -1;
+    }
+    // reserved tables are big enough from the start
+    if(Reserve && (Writer.m_ItemsCapacity != ItemsCapacity || Writer.m_DatasCapacity != DatasCapacity))
+        return -1;
+    if(!libtw07_datafile_writer_finish(&Writer))
+        return -1;
+    int Size;
+    void *pFile = libtw07_datafile_writer_takeMemory(&Writer, &Size);
+    libtw07_datafile_writer_destroy(&Writer);
+
+    libtw07_datafileReader Reader;
+    libtw07_datafile_reader_init(&Reader);
+    if(libtw07_datafile_reader_openMemory(&Reader, pFile, Size, LIBTW07_DATAFILE_MEMORY_TAKE) != 0)
+    {
+        free(pFile);
+        return -1;
+    }
+    if(libtw07_datafile_reader_numItems(&Reader) != NUM_LARGE_ITEMS || libtw07_datafile_reader_numData(&Reader) != NUM_LARGE_DATAS || libtw07_datafile_reader_numItemTypes(&Reader) != NUM_LARGE_TYPES)
+        return -1;
+    for(int i = 0; i < NUM_LARGE_ITEMS; i++)
+    {
+        int *pItem = (int *) libtw07_datafile_reader_findItem(&Reader, i % NUM_LARGE_TYPES, i / NUM_LARGE_TYPES);
+        if(!pItem || pItem[0] != i || pItem[1] != i % NUM_LARGE_DATAS)
+            return -1;
+    }
+    for(int i = 0; i < NUM_LARGE_DATAS; i++)
+    {
+        int *pData = (int *) libtw07_datafile_reader_getData(&Reader, i);
+        if(!pData || libtw07_datafile_reader_getDataSize(&Reader, i) != 4 * (int) sizeof(int) || pData[0] != i || pData[3] != i * 7)
+            return -1;
+    }
+    libtw07_datafile_reader_close(&Reader);
+    return 0;
+}
+
+int main(int argc, const char **argv)
+{
+    libtw07_datafileReader Map;
+    libtw07_datafile_reader_init(&Map);
+    if(libtw07_datafile_reader_open(&Map, "test.map") != 0)
+        return -1;
+
+    libtw07_jobPool Pool;
+    if(libtw07_jobpool_init(&Pool, 4) != 0)
+        return -1;
+
+    // the reference is read back from memory, raw copies of its blocks keep the compressed bytes
+    int RefSize;
+    SHA256_DIGEST RefSha256;
+    uint32_t RefCrc;
+    char *pRef = Write(&Map, &Pool, MODE_PLAIN, &RefSize, &RefSha256, &RefCrc);
+    if(!pRef)
+        return -1;
+    libtw07_datafileReader Source;
+    libtw07_datafile_reader_init(&Source);
+    if(libtw07_datafile_reader_openMemory(&Source, pRef, RefSize, LIBTW07_DATAFILE_MEMORY_BORROW) != 0)
+        return -1;
+
+    // the writer hashes what it writes, the reader hashes what it reads
+    SHA256_DIGEST Sha256 = libtw07_datafile_reader_sha256(&Source);
+    if(libtw07_datafile_reader_crc(&Source) != RefCrc || memcmp(&Sha256, &RefSha256, sizeof(Sha256)) != 0)
+        return -1;
+    printf("writer hashes match the reader, %d bytes\n", RefSize);
+
+    for(int Mode = MODE_PLAIN + 1; Mode < NUM_MODES; Mode++)
+    {
+        int Size;
+        uint32_t Crc;
+        char *pFile = Write(&Source, &Pool, Mode, &Size, &Sha256, &Crc);
+        if(!pFile || Size != RefSize || memcmp(pFile, pRef, Size) != 0 || Crc != RefCrc || memcmp(&Sha256, &RefSha256, sizeof(Sha256)) != 0)
+        {
+            printf("%s writer differs from the plain one\n", s_apModeNames[Mode]);
+            return -1;
+        }
+        free(pFile);
+        printf("%s writer output is identical\n", s_apModeNames[Mode]);
+    }
+
+    // a block that was added before gets the earlier index and is not stored again
+    libtw07_datafileWriter Writer;
+    libtw07_datafile_writer_init(&Writer);
+    libtw07_datafile_writer_openMemory(&Writer);
+    libtw07_datafile_writer_setDedup(&Writer, 1);
+    int Size = libtw07_datafile_reader_getDataSize(&Source, 0);
+    void *pData = libtw07_datafile_reader_getData(&Source, 0);
+    int First = libtw07_datafile_writer_addData(&Writer, Size, pData);
+    int Other = libtw07_datafile_writer_addData(&Writer, 4, "abc");
+    int Second = libtw07_datafile_writer_addData(&Writer, Size, pData);
+    libtw07_datafileDedupStats Stats;
+    libtw07_datafile_writer_getDedupStats(&Writer, &Stats);
+    if(First != 0 || Other != 1 || Second != First || Stats.m_NumDuplicates != 1 || Stats.m_BytesSaved != Size)
+        return -1;
+    libtw07_datafile_writer_destroy(&Writer);
+    printf("dedup returned index %d again and saved %d bytes\n", Second, (int) Stats.m_BytesSaved);
+
+    // a finish that fails leaves nothing for takeMemory
+    libtw07_datafile_writer_init(&Writer);
+    libtw07_datafile_writer_openMemory(&Writer);
+    if(libtw07_datafile_writer_enableSpill(&Writer) != 0 || libtw07_datafile_writer_addData(&Writer, Size, pData) != 0)
+        return -1;
+    Writer.m_SpillFailed = 1; // as if the spill file could not be written
+    int FailedSize = -1;
+    if(libtw07_datafile_writer_finish(&Writer) || libtw07_datafile_writer_takeMemory(&Writer, &FailedSize) != 0 || FailedSize != 0)
+        return -1;
+    libtw07_datafile_writer_destroy(&Writer);
+    printf("a failed finish leaves no memory file\n");
+
+    // every level and strategy gives blocks the reader inflates to the original bytes
+    static const int s_aStrategies[] = {LIBTW07_DATAFILE_STRATEGY_DEFAULT, LIBTW07_DATAFILE_STRATEGY_FILTERED, LIBTW07_DATAFILE_STRATEGY_HUFFMAN_ONLY, LIBTW07_DATAFILE_STRATEGY_RLE, LIBTW07_DATAFILE_STRATEGY_FIXED};
+    int NumStrategies = sizeof(s_aStrategies) / sizeof(s_aStrategies[0]);
+    for(int s = 0; s < NumStrategies; s++)
+    {
+        for(int Level = LIBTW07_DATAFILE_COMPRESSION_DEFAULT; Level <= LIBTW07_DATAFILE_COMPRESSION_BEST; Level++)
+        {
+            if(WriteCompressed(&Source, Level, s_aStrategies[s]) != 0)
+            {
+                printf("compression level=%d strategy=%d does not read back\n", Level, s_aStrategies[s]);
+                return -1;
+            }
+        }
+    }
+    printf("%d strategies with levels %d to %d read back\n", NumStrategies, LIBTW07_DATAFILE_COMPRESSION_DEFAULT, LIBTW07_DATAFILE_COMPRESSION_BEST);
+
+    for(int Reserve = 0; Reserve < 2; Reserve++)
+    {
+        if(WriteLarge(Reserve, 0) != 0)
+        {
+            printf("large file differs, reserve=%d\n", Reserve);
+            return -1;
+        }
+    }
+    printf("%d items and %d data blocks read back, with and without reserve\n", NUM_LARGE_ITEMS, NUM_LARGE_DATAS);
+    if(WriteLarge(0, &Pool) != 0)
+    {
+        printf("large file spilled on the pool differs\n");
+        return -1;
+    }
+    printf("%d data blocks spilled on the pool with at most %d in memory\n", NUM_LARGE_DATAS, LIBTW07_DATAFILE_WRITER_SPILL_QUEUE);
+
+    libtw07_datafile_reader_close(&Source);
+    libtw07_datafile_reader_close(&Map);
+    libtw07_jobpool_destroy(&Pool);
+    free(pRef);
+    return 0;
+}